@@ -1,4 +1,7 @@
 #include "ShadowMap.h"
+#include "shaderbuilder.h"
+#include "meshoptimizer.h"
+#include "geometryarena.h"
 
 #include <QtGlobal>
 
@@ -6,6 +9,8 @@
 #include <QFile>
 #include <QImage>
 #include <QTime>
+#include <QElapsedTimer>
+#include <QScreen>
 
 #include <QVector2D>
 #include <QVector3D>
@@ -13,15 +18,64 @@
 
 #include <cmath>
 #include <cstring>
+#include <random>
 
 MyWindow::~MyWindow()
 {
+    mContext->makeCurrent(surface());
+
+    if (mGpuTimer != 0) {
+        mGpuTimer->flush();
+        if (!mOptions.gpuStatsFile.isEmpty()) {
+            mGpuTimer->writeCsv(mOptions.gpuStatsFile + ".csv");
+            mGpuTimer->writeJson(mOptions.gpuStatsFile + ".json");
+        }
+        delete mGpuTimer;
+    }
+
     if (mProgram != 0) delete mProgram;
+    if (mDepthProgram != 0) delete mDepthProgram;
+    if (mCascadeProgram != 0) delete mCascadeProgram;
+    delete mTessProgram;
+    delete mTessDepthProgram;
+    delete mTessCascadeProgram;
+    delete mBlurProgram;
+    delete mCapture;
+    delete mShadowTarget;
+    delete mStream;
+    delete mState;
+    delete mArena;
+    delete mMeshCache;
+    delete mProgramCache;
+    delete mOffscreenFBO;
+#ifdef GL_CALL_STATS
+    delete mFuncs;
+#endif
+
+    mContext->doneCurrent();
 }
 
-MyWindow::MyWindow()
-    : mProgram(0), currentTimeMs(0), currentTimeS(0), tPrev(0), angle(M_PI / 4.0f), shadowMapWidth(512), shadowMapHeight(512)
+MyWindow::MyWindow(bool headless, const RenderOptions &options)
+    : mHeadless(headless), mOptions(options), mGpuTimer(0), mPassName(""),
+      mOffscreenSurface(0), mOffscreenFBO(0),
+      mProgram(0), mDepthProgram(0), mCascadeProgram(0), mTessProgram(0), mTessDepthProgram(0), mTessCascadeProgram(0),
+      mBlurProgram(0), mProgramCache(0),
+      mTimerLoop(options.frameLoop == "timer"), currentTimeMs(0), currentTimeS(0), mFrameIntervals(600),
+      mLastFrameNs(0), mLastReportNs(0), mWakeups(0), mUpdateSize(true), mUpdateShadowMap(false), tPrev(0), angle(M_PI / 4.0f),
+      shadowMapWidth(options.shadowMapSize), shadowMapHeight(options.shadowMapSize),
+      shadowPassNs(0), litPassNs(0), mShadowDirty(true), mShadowLightVersion(0), mShadowCacheHits(0), mShadowCacheMisses(0),
+      mObjectsDirty(true),
+      mObjectSSBO(0), mShadowTarget(0), mStream(0), mState(0), mCapture(0), mArena(0), mMeshCache(0), lightFrustum(0)
 {
+    for (int i = 0; i < MAX_CASCADES; i++)
+        CascadeSplits[i] = 0.0f;
+    mVisibleCount[0] = mVisibleCount[1] = 0;
+    mTriangleCount[0] = mTriangleCount[1] = 0;
+    mDrawCalls[0] = mDrawCalls[1] = 0;
+    mCascadeFirst = mCascadeCount = 0;
+    mUniformAlign = mFrameStride = 256;
+    mDrawIndexOffset[0] = mDrawIndexOffset[1] = mIndirectOffset[0] = mIndirectOffset[1] = 0;
+
     setSurfaceType(QWindow::OpenGLSurface);
     setFlags(Qt::Window | Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowMinMaxButtonsHint | Qt::WindowCloseButtonHint);
 
@@ -31,8 +85,25 @@ MyWindow::MyWindow()
     format.setMinorVersion(3);
     format.setSamples(4);
     format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setSwapInterval(options.swapInterval);
     setFormat(format);
-    create();
+
+    // Headless mode never creates the native window: rendering goes to an
+    // FBO on an offscreen surface. main() selects QT_QPA_PLATFORM=offscreen
+    // for it, which needs no display server; with xcb or eglfs set
+    // explicitly the surface still needs that platform's display.
+    if (mHeadless) {
+        mOffscreenSurface = new QOffscreenSurface();
+        mOffscreenSurface->setParent(this);
+        mOffscreenSurface->setFormat(format);
+        mOffscreenSurface->create();
+        if (!mOffscreenSurface->isValid()) {
+            qWarning( "Could not create the offscreen surface, run with QT_QPA_PLATFORM=offscreen or on a display" );
+            exit( 1 );
+        }
+    } else {
+        create();
+    }
 
     resize(800, 600);
 
@@ -40,9 +111,19 @@ MyWindow::MyWindow()
     mContext->setFormat(format);
     mContext->create();
 
-    mContext->makeCurrent( this );
+    if (!mContext->makeCurrent( surface() ))
+    {
+        qWarning( "Could not make the OpenGL context current" );
+        exit( 1 );
+    }
 
+#ifdef GL_CALL_STATS
+    // The counting wrapper is not one of Qt's version objects, it resolves
+    // its entry points itself
+    mFuncs = new GlCoreFunctions;
+#else
     mFuncs = mContext->versionFunctions<QOpenGLFunctions_4_3_Core>();
+#endif
     if ( !mFuncs )
     {
         qWarning( "Could not obtain OpenGL versions object" );
@@ -56,13 +137,56 @@ MyWindow::MyWindow()
 
     initializeOpenGLFunctions();
 
-    QTimer *repaintTimer = new QTimer(this);
-    connect(repaintTimer, &QTimer::timeout, this, &MyWindow::render);
-    repaintTimer->start(1000/60);
+    if (mHeadless)
+        return;
+
+    mClock.start();
+
+    if (mTimerLoop) {
+        QTimer *repaintTimer = new QTimer(this);
+        connect(repaintTimer, &QTimer::timeout, this, &MyWindow::render);
+        connect(repaintTimer, &QTimer::timeout, this, &MyWindow::countWakeup);
+        repaintTimer->start(1000/60);
+
+        QTimer *elapsedTimer = new QTimer(this);
+        connect(elapsedTimer, &QTimer::timeout, this, &MyWindow::modCurTime);
+        connect(elapsedTimer, &QTimer::timeout, this, &MyWindow::countWakeup);
+        elapsedTimer->start(1);
+    }
+}
+
+// The next frame is requested after each one, swapBuffers() blocks on the
+// swap interval so the loop runs at the display rate
+bool MyWindow::event(QEvent *event)
+{
+    if (event->type() == QEvent::UpdateRequest && !mTimerLoop) {
+        countWakeup();
+        render();
+        if (isExposed())
+            requestUpdate();
+        return true;
+    }
+    return QWindow::event(event);
+}
 
-    QTimer *elapsedTimer = new QTimer(this);
-    connect(elapsedTimer, &QTimer::timeout, this, &MyWindow::modCurTime);
-    elapsedTimer->start(1);       
+void MyWindow::exposeEvent(QExposeEvent *)
+{
+    if (isExposed() && !mTimerLoop)
+        requestUpdate();
+}
+
+QSurface *MyWindow::surface()
+{
+    if (mHeadless)
+        return mOffscreenSurface;
+    return this;
+}
+
+GLuint MyWindow::defaultFramebuffer() const
+{
+    if (mHeadless)
+        return mOffscreenFBO->handle();
+    return mContext->defaultFramebufferObject();
 }
 
 void MyWindow::modCurTime()
@@ -71,16 +195,65 @@ void MyWindow::modCurTime()
     currentTimeS=currentTimeMs/1000.0f;
 }
 
+void MyWindow::countWakeup()
+{
+    mWakeups++;
+}
+
+// Every few seconds with --loop-stats: event loop wakeups against frames,
+// and how evenly the frames were presented
+void MyWindow::reportFrameLoop()
+{
+    qint64 now = mClock.nsecsElapsed();
+    if (mLastFrameNs != 0)
+        mFrameIntervals.add((now - mLastFrameNs) / 1.0e6);
+    mLastFrameNs = now;
+
+    double seconds = (now - mLastReportNs) / 1.0e9;
+    if (!mOptions.loopStats || seconds < 5.0)
+        return;
+
+    printf("Frame loop (%s): %.1f wakeups/s, %.1f frames/s, interval mean %.3f ms, jitter %.3f ms stddev, "
+           "p99 %.3f ms, max %.3f ms, animation clock %+.1f ms\n",
+           mTimerLoop ? "1 ms tick + 16 ms timer" : "update requests",
+           mWakeups / seconds, 1000.0 / qMax(1.0e-6, mFrameIntervals.mean()), mFrameIntervals.mean(),
+           mFrameIntervals.stddev(), mFrameIntervals.percentile(99.0), mFrameIntervals.max(),
+           currentTimeS * 1000.0 - now / 1.0e6);
+    fflush(stdout);
+
+    mWakeups = 0;
+    mLastReportNs = now;
+    mFrameIntervals.clear();
+}
+
 void MyWindow::initialize()
 {
+    // The benchmark keeps every sample, the interactive window a rolling window
+    mGpuTimer = new GpuTimer(mFuncs, 4, mHeadless ? 0 : 240);
+    mState = new GlState(mFuncs);
+    if (!mOptions.captureFile.isEmpty()) {
+        // The rate frames are paced at: the benchmark's fixed time step, the
+        // display refresh over the swap interval, or the 16 ms repaint timer
+        // when that is slower. Unthrottled it is only nominal.
+        double fps = 60.0;
+        if (!mHeadless && screen() != 0) {
+            double display = screen()->refreshRate() / qMax(1, mOptions.swapInterval);
+            fps = !mTimerLoop ? display : mOptions.swapInterval > 0 ? qMin(display, 1000.0 / 16) : 1000.0 / 16;
+        }
+        mCapture = new FrameCapture(mFuncs, mOptions.captureFile,
+                                    mOptions.captureFormat == "y4m" ? FrameCapture::Y4M : FrameCapture::RAW_RGBA,
+                                    fps, mOptions.captureRing);
+    }
+
     CreateVertexBuffer();
+    mShadowTarget = new ShadowMapTarget(mFuncs);
     setupFBO();
 
     initShaders();
-    pass1Index = mFuncs->glGetSubroutineIndex(mProgram->programId(), GL_FRAGMENT_SHADER, "recordDepth");
-    pass2Index = mFuncs->glGetSubroutineIndex(mProgram->programId(), GL_FRAGMENT_SHADER, "shadeWithShadow");
 
     initMatrices();
+    initScene();
+    initUniformBuffers();
 
     //mRotationMatrixLocation = mProgram->uniformLocation("RotationMatrix");
 
@@ -89,7 +262,6 @@ void MyWindow::initialize()
     QVector3D lightPos(0.0f,c * 5.25f, c * 7.5f);  // World coords
     lightFrustum->orient( lightPos, QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f,1.0f,0.0f));
     lightFrustum->setPerspective( 50.0f, 1.0f, 1.0f, 25.0f);
-    LightPV = shadowBias * lightFrustum->getProjectionMatrix() * lightFrustum->getViewMatrix();
 
     glFrontFace(GL_CCW);
     glEnable(GL_DEPTH_TEST);
@@ -97,154 +269,280 @@ void MyWindow::initialize()
     glPolygonOffset(1.0, 1.0);
 }
 
+// Describes the shadow map the options ask for to mShadowTarget, which
+// only reallocates when that differs from what it has
 void MyWindow::setupFBO()
 {
-    GLfloat border[] = {1.0f, 0.0f,0.0f,0.0f };
-    // The depth buffer texture
-    GLuint depthTex;
-    glGenTextures(1, &depthTex);
-    glBindTexture(GL_TEXTURE_2D, depthTex);
-    mFuncs->glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, shadowMapWidth, shadowMapHeight);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
-
-    // Assign the depth buffer texture to texture channel 0
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depthTex);
+    ShadowMapTarget::Config config;
+    config.width = shadowMapWidth;
+    config.height = shadowMapHeight;
+    config.layers = mOptions.cascades;
+    ShadowMapTarget::parseDepthFormat(mOptions.shadowFormat, config.depth);
+    config.linearFilter = mOptions.pcfKernel != "none";
+    config.moments = mOptions.shadowFilter == "vsm" ? ShadowMapTarget::VSM_MOMENTS
+                   : mOptions.shadowFilter == "esm" ? ShadowMapTarget::ESM_MOMENTS : ShadowMapTarget::NO_MOMENTS;
+    config.esmExponent = mOptions.esmExponent;
+    if (!mShadowTarget->configure(config))
+        return;
 
-    // Create and set up the FBO
-    glGenFramebuffers(1, &shadowFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                           GL_TEXTURE_2D, depthTex, 0);
+    // Assign the texture the lit pass samples to texture channel 0
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(mShadowTarget->getSampledTarget(), mShadowTarget->getSampledTexture());
 
-    GLenum drawBuffers[] = {GL_NONE};
-    mFuncs->glDrawBuffers(1, drawBuffers);
+    mShadowDirty = true;
 
-    GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if( result == GL_FRAMEBUFFER_COMPLETE) {
+    if (mShadowTarget->isComplete()) {
         printf("Framebuffer is complete.\n");
     } else {
         printf("Framebuffer is not complete.\n");
     }
-
-    glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
 
-
-void MyWindow::CreateVertexBuffer()
+// Separable box blur of the VSM/ESM moments: rows into the blur texture,
+// then columns back into level 0 of the moments, whose mips are then rebuilt.
+// A radius of n averages the same (2n+1)x(2n+1) texels as the PCF grid.
+void MyWindow::blurShadowMap()
 {
-    // *** Teapot
-    mFuncs->glGenVertexArrays(1, &mVAOTeapot);
-    mFuncs->glBindVertexArray(mVAOTeapot);
+    GLenum format = mShadowTarget->getMomentsFormat();
+    GLuint moments = mShadowTarget->getMomentsTexture();
+    GLuint blur = mShadowTarget->getBlurTexture();
+    const int groupSize = 128;          // local_size_x of blurcshader.txt
+
+    if (mOptions.shadowBlur > 0) {
+        mState->useProgram(mBlurProgram->programId());
+        for (int horizontal = 1; horizontal >= 0; horizontal--)
+        {
+            GLuint source = horizontal ? moments : blur;
+            GLuint target = horizontal ? blur : moments;
+            int length = horizontal ? shadowMapWidth : shadowMapHeight;
+            int lines = horizontal ? shadowMapHeight : shadowMapWidth;
+
+            mFuncs->glBindImageTexture(0, source, 0, GL_FALSE, 0, GL_READ_ONLY, format);
+            mFuncs->glBindImageTexture(1, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+            mState->uniform1i(0, horizontal);
+            mFuncs->glDispatchCompute((length + groupSize - 1) / groupSize, lines, 1);
+            // The column pass reads what the row pass stored
+            mFuncs->glMemoryBarrier(horizontal ? GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+                                               : GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        }
+    }
 
-    QMatrix4x4 transform;    
-    mTeapot = new Teapot(14, transform);
+    mState->bindTexture(0, GL_TEXTURE_2D, moments);
+    mFuncs->glGenerateMipmap(GL_TEXTURE_2D);
+}
 
-    // Create and populate the buffer objects
-    unsigned int TeapotHandles[3];
-    glGenBuffers(3, TeapotHandles);
 
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTeapot->getnVerts()) * sizeof(float), mTeapot->getv(), GL_STATIC_DRAW);
+// Size of a mesh before and after packing
+// Against the positions and normals the baseline uploaded. The packed
+// size includes texture coordinates the baseline did not have, listed
+// separately.
+static void printMeshSize(const char *name, int level, const PackedMesh &mesh)
+{
+    printf("Mesh %-6s LOD %d %7d verts %7d tris: %2d -> %2d bytes/vertex, 32 -> %d bit indices, %.1f -> %.1f KB"
+           " (%.1f KB texcoords)\n",
+           name, level, mesh.getnVerts(), mesh.getnIndices() / 3, 6 * (int)sizeof(float), mesh.bytesPerVertex(),
+           8 * mesh.indexSize(), PackedMesh::unpackedBytes(mesh.getnVerts(), mesh.getnIndices()) / 1024.0,
+           mesh.totalBytes() / 1024.0, mesh.texCoordBytes() / 1024.0);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, TeapotHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTeapot->getnVerts()) * sizeof(float), mTeapot->getn(), GL_STATIC_DRAW);
+// Grids of a LOD chain, each about half the previous one down to min
+static QVector<int> lodGrids(int finest, int min, bool enabled)
+{
+    QVector<int> grids;
+    grids.append(finest);
+    while (enabled && grids.size() < 4 && grids.last() / 2 >= min)
+        grids.append(grids.last() / 2);
+    return grids;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TeapotHandles[2]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * mTeapot->getnFaces() * sizeof(unsigned int), mTeapot->getelems(), GL_STATIC_DRAW);
+static QString gridList(const QVector<int> &grids)
+{
+    QStringList list;
+    for (int i = 0; i < grids.size(); i++)
+        list.append(QString::number(grids[i]));
+    return list.join(",");
+}
 
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, TeapotHandles[0], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(0, 0);
+void MyWindow::CreateVertexBuffer()
+{
+    QElapsedTimer timer;
+    timer.start();
 
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, TeapotHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
+    // Every mesh goes into the same buffers
+    mArena = new GeometryArena(mFuncs);
 
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TeapotHandles[2]);
+    // Packed chains from an earlier run are mapped instead of generated
+    if (!mOptions.meshCacheDir.isEmpty() && mMeshCache == 0) {
+        mMeshCache = new MeshCache(mOptions.meshCacheDir);
+        if (mOptions.meshCacheClear)
+            mMeshCache->clear();
+    }
+    QVector<PackedMesh> meshes;
 
-    mFuncs->glBindVertexArray(0);
+    // *** Teapot
+    // With GPU tessellation only the patches are drawn, the mesh is kept at
+    // the coarsest grid unless the comparison sweep needs both
+    bool patchesOnly = mOptions.gpuTessellation && mOptions.sweep != "tessellation";
+    int  meshGrid = patchesOnly ? 1 : mOptions.teapotGrid;
+    QMatrix4x4 transform;
+    bool buildLods = mOptions.meshLod || mOptions.sweep == "lod";
+    QVector<int> teapotGrids = lodGrids(meshGrid, 2, buildLods && !patchesOnly);
+    QStringList lid;
+    for (int i = 0; i < 16; i++)
+        lid.append(QString::number(transform.constData()[i]));
+    QString key = meshCacheKey(QString("teapot grids=%1 lid=%2").arg(gridList(teapotGrids)).arg(lid.join(",")));
+    if (mMeshCache == 0 || !mMeshCache->load(key, meshes, mTeapotCenter, mTeapotExtent))
+    {
+        QVector<Teapot *> teapots;
+        QVector<MeshArrays> levels;
+        for (int i = 0; i < teapotGrids.size(); i++)
+        {
+            Teapot *teapot = new Teapot(teapotGrids[i], transform);
+            MeshArrays level = { teapot->getv(), teapot->getn(), teapot->gettc(), (int)teapot->getnVerts(),
+                                 teapot->getelems(), 6 * (int)teapot->getnFaces() };
+            teapots.append(teapot);
+            levels.append(level);
+        }
+        meshes = packLodChain(levels, mTeapotCenter, mTeapotExtent);
+        if (mMeshCache != 0)
+            mMeshCache->store(key, meshes, mTeapotCenter, mTeapotExtent);
+        qDeleteAll(teapots);
+    }
+    mTeapotLods = addLodChain("teapot", meshes);
+    mTeapotMesh = meshes[0];
+    mTeapotRange = mTeapotLods[0];
+
+    // A patch lies inside the box of its control points, which bounds the
+    // surface when the grid 1 mesh does not
+    QVector<float> controlPoints = Teapot::controlPoints(transform);
+    if (patchesOnly)
+        BoundsCuller::computeBounds(controlPoints.constData(), controlPoints.size() / 3, mTeapotCenter, mTeapotExtent);
+
+    // The control points go through the inverse of the mesh transform, so
+    // the objects' model matrices place both the same way
+    QMatrix4x4 toMesh = mTeapotMesh.getPositionTransform().inverted();
+    for (int i = 0; i < controlPoints.size(); i += 3) {
+        QVector3D p = toMesh * QVector3D(controlPoints[i], controlPoints[i + 1], controlPoints[i + 2]);
+        controlPoints[i] = p.x(); controlPoints[i + 1] = p.y(); controlPoints[i + 2] = p.z();
+    }
+    mTeapotPatches = mArena->addPatches(controlPoints);
+    printf("Teapot patches: %d control points, %.1f KB against %.1f KB for the grid %d mesh\n", mTeapotPatches.count,
+           controlPoints.size() * sizeof(float) / 1024.0, mTeapotMesh.totalBytes() / 1024.0, meshGrid);
 
     // *** Plane
-    mFuncs->glGenVertexArrays(1, &mVAOPlane);
-    mFuncs->glBindVertexArray(mVAOPlane);
-
-    mPlane = new VBOPlane(40.0f, 40.0f, 2.0, 2.0);
-
-    // Create and populate the buffer objects
-    unsigned int PlaneHandles[3];
-    glGenBuffers(3, PlaneHandles);
-
-    glBindBuffer(GL_ARRAY_BUFFER, PlaneHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mPlane->getnVerts()) * sizeof(float), mPlane->getv(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, PlaneHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mPlane->getnVerts()) * sizeof(float), mPlane->getn(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, PlaneHandles[2]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * mPlane->getnFaces() * sizeof(unsigned int), mPlane->getelems(), GL_STATIC_DRAW);
-
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, PlaneHandles[0], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(0, 0);
-
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, PlaneHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
-
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, PlaneHandles[2]);
-
-    mFuncs->glBindVertexArray(0);
+    // Two triangles per cell already, it has nothing to simplify
+    key = meshCacheKey("plane size=40x40 cells=2x2 tc=1x1");
+    if (mMeshCache == 0 || !mMeshCache->load(key, meshes, mPlaneCenter, mPlaneExtent))
+    {
+        VBOPlane *plane = new VBOPlane(40.0f, 40.0f, 2.0, 2.0);
+        MeshArrays level = { plane->getv(), plane->getn(), plane->gettc(), (int)plane->getnVerts(),
+                             plane->getelems(), 6 * (int)plane->getnFaces() };
+        meshes = packLodChain(QVector<MeshArrays>() << level, mPlaneCenter, mPlaneExtent);
+        if (mMeshCache != 0)
+            mMeshCache->store(key, meshes, mPlaneCenter, mPlaneExtent);
+        delete plane;
+    }
+    mPlaneLods = addLodChain("plane", meshes);
+    mPlaneMesh = meshes[0];
+    mPlaneRange = mPlaneLods[0];
 
     // *** Torus
-    mFuncs->glGenVertexArrays(1, &mVAOTorus);
-    mFuncs->glBindVertexArray(mVAOTorus);
-
-    mTorus = new Torus(0.7f * 2.0f, 0.3f * 2.0f, 50, 50);
-
-    // Create and populate the buffer objects
-    unsigned int TorusHandles[3];
-    glGenBuffers(3, TorusHandles);
-
-    glBindBuffer(GL_ARRAY_BUFFER, TorusHandles[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTorus->getnVerts()) * sizeof(float), mTorus->getv(), GL_STATIC_DRAW);
+    QVector<int> torusGrids = lodGrids(50, 6, buildLods);
+    key = meshCacheKey(QString("torus radii=1.4,0.6 grids=%1").arg(gridList(torusGrids)));
+    if (mMeshCache == 0 || !mMeshCache->load(key, meshes, mTorusCenter, mTorusExtent))
+    {
+        QVector<Torus *> tori;
+        QVector<MeshArrays> levels;
+        for (int i = 0; i < torusGrids.size(); i++)
+        {
+            Torus *torus = new Torus(0.7f * 2.0f, 0.3f * 2.0f, torusGrids[i], torusGrids[i]);
+            MeshArrays level = { torus->getv(), torus->getn(), torus->gettex(), (int)torus->getnVerts(),
+                                 torus->getel(), 6 * (int)torus->getnFaces() };
+            tori.append(torus);
+            levels.append(level);
+        }
+        meshes = packLodChain(levels, mTorusCenter, mTorusExtent);
+        if (mMeshCache != 0)
+            mMeshCache->store(key, meshes, mTorusCenter, mTorusExtent);
+        qDeleteAll(tori);
+    }
+    mTorusLods = addLodChain("torus", meshes);
+    mTorusMesh = meshes[0];
+    mTorusRange = mTorusLods[0];
+
+    mArena->upload();
+    printf("Geometry arena: %.1f KB, %d bit indices\n", mArena->totalBytes() / 1024.0,
+           mArena->getIndexType() == GL_UNSIGNED_SHORT ? 16 : 32);
+    if (mMeshCache != 0)
+        printf("Geometry setup: %.2f ms, mesh cache %d hits, %d misses\n", timer.nsecsElapsed() / 1.0e6,
+               mMeshCache->getHits(), mMeshCache->getMisses());
+    else
+        printf("Geometry setup: %.2f ms, mesh cache off\n", timer.nsecsElapsed() / 1.0e6);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, TorusHandles[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * mTorus->getnVerts()) * sizeof(float), mTorus->getn(), GL_STATIC_DRAW);
+// Cache key of a generated chain: the generator's own parameters plus
+// everything done to its arrays before they are packed
+QString MyWindow::meshCacheKey(const QString &generator) const
+{
+    return QString("%1 positions=%2 indices=%3").arg(generator)
+            .arg(mOptions.quantizePositions ? "snorm16" : "float")
+            .arg(!mOptions.optimizeIndices ? "generated" : mOptions.overdrawOrder ? "vcache+overdraw" : "vcache");
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TorusHandles[2]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * mTorus->getnFaces() * sizeof(unsigned int), mTorus->getel(), GL_STATIC_DRAW);
+// Optimizes and packs the levels of a chain, finest first. All levels are
+// quantized in the box around all of them so that the objects' position
+// transform, taken from the finest, fits each one.
+QVector<PackedMesh> MyWindow::packLodChain(const QVector<MeshArrays> &levels, QVector3D &center, QVector3D &extent)
+{
+    QVector3D lo, hi;
+    for (int i = 0; i < levels.size(); i++)
+    {
+        const MeshArrays &level = levels[i];
+        optimizeIndices(level.el, level.nIndices, level.v, level.nVerts);
 
-    // Setup the VAO
-    // Vertex positions
-    mFuncs->glBindVertexBuffer(0, TorusHandles[0], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(0, 0);
+        QVector3D c, e;
+        BoundsCuller::computeBounds(level.v, level.nVerts, c, e);
+        lo = i == 0 ? c - e : QVector3D(qMin(lo.x(), c.x() - e.x()), qMin(lo.y(), c.y() - e.y()), qMin(lo.z(), c.z() - e.z()));
+        hi = i == 0 ? c + e : QVector3D(qMax(hi.x(), c.x() + e.x()), qMax(hi.y(), c.y() + e.y()), qMax(hi.z(), c.z() + e.z()));
+    }
+    center = 0.5f * (lo + hi);
+    extent = 0.5f * (hi - lo);
 
-    // Vertex normals
-    mFuncs->glBindVertexBuffer(1, TorusHandles[1], 0, sizeof(GLfloat) * 3);
-    mFuncs->glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, 0);
-    mFuncs->glVertexAttribBinding(1, 1);
+    PackedMesh::PositionFormat format = mOptions.quantizePositions ? PackedMesh::QUANTIZED_POSITIONS
+                                                                   : PackedMesh::FLOAT_POSITIONS;
+    QMatrix4x4 box = PackedMesh::boxTransform(lo, hi);
 
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TorusHandles[2]);
+    QVector<PackedMesh> meshes;
+    for (int i = 0; i < levels.size(); i++)
+    {
+        const MeshArrays &level = levels[i];
+        meshes.append(PackedMesh(level.v, level.n, level.tc, level.nVerts, level.el, level.nIndices, format, &box));
+    }
+    return meshes;
+}
 
-    mFuncs->glBindVertexArray(0);
+QVector<MeshRange> MyWindow::addLodChain(const char *name, const QVector<PackedMesh> &meshes)
+{
+    QVector<MeshRange> ranges;
+    for (int i = 0; i < meshes.size(); i++) {
+        // The arena draws every mesh with the first one's position format
+        MeshRange range;
+        if (!mArena->add(meshes[i], range)) {
+            qWarning( "Could not add the %s mesh to the geometry arena", name );
+            exit( 1 );
+        }
+        ranges.append(range);
+        printMeshSize(name, i, meshes[i]);
+    }
+    return ranges;
+}
 
+// Triangle order for the post-transform vertex cache, in place on the
+// generated index arrays
+void MyWindow::optimizeIndices(unsigned int *el, int nIndices, const float *v, int nVerts)
+{
+    if (mOptions.optimizeIndices)
+        MeshOptimizer::optimize(el, nIndices, v, nVerts, mOptions.overdrawOrder);
 }
 
 void MyWindow::initMatrices()
@@ -270,6 +568,366 @@ void MyWindow::initMatrices()
 
 }
 
+void MyWindow::initScene()
+{
+    mObjects.clear();
+
+    QVector3D color(0.7f,0.5f,0.3f);
+
+    Material copper;
+    copper.Ka = color * 0.05f;
+    copper.Kd = color;
+    copper.Ks = QVector3D(0.9f, 0.9f, 0.9f);
+    copper.Shininess = 150.0f;
+
+    Material grey;
+    grey.Ka = QVector3D(0.05f, 0.05f, 0.05f);
+    grey.Kd = QVector3D(0.25f, 0.25f, 0.25f);
+    grey.Ks = QVector3D(0.0f,  0.0f,  0.0f);
+    grey.Shininess = 1.0f;
+
+    if (mOptions.stressCount > 0) {
+        SceneObject ground = { "plane", mPlaneRange, ModelMatrixPlane[0], mPlaneMesh.getPositionTransform(), grey,
+                                  mPlaneCenter, mPlaneExtent, ALL_PASSES };
+        mObjects.append(ground);
+        addStressObjects(mOptions.stressCount, mOptions.stressRandom, copper);
+        return;
+    }
+
+    SceneObject teapot = { "teapot", mTeapotRange, ModelMatrixTeapot, mTeapotMesh.getPositionTransform(), copper,
+                              mTeapotCenter, mTeapotExtent, ALL_PASSES };
+    mObjects.append(teapot);
+
+    for (int i=0; i<3; i++)
+    {
+        SceneObject plane = { "plane", mPlaneRange, ModelMatrixPlane[i], mPlaneMesh.getPositionTransform(), grey,
+                                 mPlaneCenter, mPlaneExtent, ALL_PASSES };
+        mObjects.append(plane);
+    }
+
+    SceneObject torus = { "torus", mTorusRange, ModelMatrixTorus, mTorusMesh.getPositionTransform(), copper,
+                            mTorusCenter, mTorusExtent, ALL_PASSES };
+    mObjects.append(torus);
+}
+
+// Stress scene: count teapots and tori, half each, on a grid or scattered
+// over the ground plane. They are shrunk as count grows so the scene always
+// fits the same area and stays in view.
+void MyWindow::addStressObjects(int count, bool random, const Material &base)
+{
+    const float area = 36.0f;
+    const float footprint = 7.0f;       // Rough size of a teapot at scale 1
+
+    int side = (int)ceil(sqrt((double)count));
+    float cell = area / side;
+    float scale = qMin(1.0f, cell / footprint);
+
+    // Tints so neighbouring instances are told apart
+    const QVector3D tints[] = { QVector3D(1.0f, 1.0f, 1.0f), QVector3D(0.6f, 0.9f, 1.2f),
+                                QVector3D(1.2f, 0.7f, 0.6f), QVector3D(0.7f, 1.2f, 0.7f) };
+
+    // Same orientations as in the default scene, without the placement
+    QMatrix4x4 torusTilt;
+    torusTilt.rotate(-45.0f, QVector3D(1.0f, 0.0f, 0.0f));
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // The first half are teapots, the rest tori
+    for (int i = 0; i < count; i++)
+    {
+        bool isTeapot = i < (count + 1) / 2;
+
+        float x, z, yaw;
+        if (random) {
+            x = (unit(rng) - 0.5f) * area;
+            z = (unit(rng) - 0.5f) * area;
+            yaw = 360.0f * unit(rng);
+        } else {
+            x = -0.5f * area + ((i % side) + 0.5f) * cell;
+            z = -0.5f * area + ((i / side) + 0.5f) * cell;
+            yaw = 0.0f;
+        }
+
+        QMatrix4x4 model;
+        model.translate(x, isTeapot ? 0.0f : 2.0f * scale, z);
+        model.rotate(yaw, QVector3D(0.0f, 1.0f, 0.0f));
+        model.scale(scale);
+        model *= isTeapot ? ModelMatrixTeapot : torusTilt;
+
+        Material material = base;
+        material.Kd = base.Kd * tints[i % 4];
+        material.Ka = material.Kd * 0.05f;
+
+        SceneObject object = { isTeapot ? "teapot" : "torus", isTeapot ? mTeapotRange : mTorusRange, model,
+                               isTeapot ? mTeapotMesh.getPositionTransform() : mTorusMesh.getPositionTransform(), material,
+                               isTeapot ? mTeapotCenter : mTorusCenter, isTeapot ? mTeapotExtent : mTorusExtent,
+                               ALL_PASSES };
+        mObjects.append(object);
+    }
+}
+
+void MyWindow::initUniformBuffers()
+{
+    // Called again when the scene is regenerated
+    if (mObjectSSBO != 0) glDeleteBuffers(1, &mObjectSSBO);
+
+    // The frame blocks of both passes are streamed, see buildDrawCommands
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &mUniformAlign);
+    mFrameStride  = (sizeof(FrameUniforms)  + mUniformAlign - 1) / mUniformAlign * mUniformAlign;
+
+    // Object data does not depend on the pass, both read the same copy
+    glGenBuffers(1, &mObjectSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mObjects.size() * sizeof(ObjectUniforms), NULL, GL_DYNAMIC_DRAW);
+
+    // Materials never change, the matrices only when an object moves
+    mObjectData.fill(0, mObjects.size() * sizeof(ObjectUniforms));
+    for (int i = 0; i < mObjects.size(); i++)
+    {
+        const Material &m = mObjects[i].material;
+        ObjectUniforms *block = (ObjectUniforms *)mObjectData.data() + i;
+
+        block->Ka[0] = m.Ka.x(); block->Ka[1] = m.Ka.y(); block->Ka[2] = m.Ka.z();
+        block->Kd[0] = m.Kd.x(); block->Kd[1] = m.Kd.y(); block->Kd[2] = m.Kd.z();
+        block->Ks[0] = m.Ks.x(); block->Ks[1] = m.Ks.y(); block->Ks[2] = m.Ks.z();
+        block->Shininess = m.Shininess;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    mObjectsDirty = true;
+    indexObjects();
+}
+
+// Numbers the meshes and materials of the objects for the render queue
+// keys. The mesh table holds every level of the three LOD chains, an
+// object refers to the finest level of its chain.
+void MyWindow::indexObjects()
+{
+    const QVector<MeshRange> *chains[] = { &mTeapotLods, &mTorusLods, &mPlaneLods };
+    int chainBase[3];
+    mMeshTable.clear();
+    for (int c = 0; c < 3; c++)
+    {
+        chainBase[c] = mMeshTable.size();
+        mMeshTable += *chains[c];
+    }
+
+    QVector<Material> materials;
+    mObjectMesh.resize(mObjects.size());
+    mObjectLevels.resize(mObjects.size());
+    mObjectMaterial.resize(mObjects.size());
+    for (int i = 0; i < mObjects.size(); i++)
+    {
+        const SceneObject &object = mObjects[i];
+
+        int c = 2;
+        if (object.mesh.firstIndex == mTeapotRange.firstIndex)
+            c = 0;
+        else if (object.mesh.firstIndex == mTorusRange.firstIndex)
+            c = 1;
+        mObjectMesh[i] = chainBase[c];
+        mObjectLevels[i] = chains[c]->size();
+
+        const Material &m = object.material;
+        int id = 0;
+        while (id < materials.size() && !(materials[id].Ka == m.Ka && materials[id].Kd == m.Kd
+                                          && materials[id].Ks == m.Ks && materials[id].Shininess == m.Shininess))
+            id++;
+        if (id == materials.size())
+            materials.append(m);
+        mObjectMaterial[i] = id;
+    }
+
+    mWorldBounds.resize(mObjects.size());
+    mVisible.resize(mObjects.size());
+    for (int pass = 0; pass < 2; pass++)
+        mObjectLod[pass].fill(0, mObjects.size());
+
+    // A frame streams the frame block, the draw index list and the
+    // commands of both passes, each padded up to its alignment. A pass has
+    // at most one command per mesh, plus one for the teapot patches.
+    GLsizeiptr perPass = (mFrameStride + mUniformAlign) + (mObjects.size() + 1) * sizeof(GLuint)
+                       + (mMeshTable.size() + 2) * sizeof(DrawElementsIndirectCommand);
+    if (mStream == 0)
+        mStream = new StreamBuffer(mFuncs, mOptions.streamRegions);
+    mStream->reserve(2 * perPass);
+}
+
+// Picks a level per visible object from the projected size of its bounds:
+// the finest while they cover lodPixels or more, one coarser per halving,
+// plus the bias of the pass. A level is only left once the size is
+// lodHysteresis levels past the boundary, so objects sitting on one do not
+// flicker between two.
+void MyWindow::selectLods(int pass, const QMatrix4x4 &viewProj, float viewportHeight)
+{
+    QVector4D row3 = viewProj.row(3);
+    float pixelScale = viewProj.row(1).toVector3D().length() * viewportHeight;
+    float bias = pass == 0 ? mOptions.shadowLodBias : 0.0f;
+    float hysteresis = mOptions.lodHysteresis;
+    QVector<unsigned char> &lods = mObjectLod[pass];
+
+    for (int i = 0; i < mObjects.size(); i++)
+    {
+        if (!mVisible[i])
+            continue;
+
+        QVector3D center(mWorldBounds.cx[i], mWorldBounds.cy[i], mWorldBounds.cz[i]);
+        QVector3D extent(mWorldBounds.ex[i], mWorldBounds.ey[i], mWorldBounds.ez[i]);
+        float w = QVector4D::dotProduct(row3, QVector4D(center, 1.0f));
+        float pixels = extent.length() * pixelScale / qMax(w, 1.0e-4f);
+        float x = log2f(mOptions.lodPixels / qMax(pixels, 1.0e-3f)) + bias;
+
+        int levels = mObjectLevels[i];
+        int lod = lods[i];
+        while (lod + 1 < levels && x > lod + 1 + hysteresis)
+            lod++;
+        while (lod > 0 && x < lod - hysteresis)
+            lod--;
+        lods[i] = lod;
+    }
+}
+
+// Culls the objects against the frustum of the pass, picks their LOD and
+// has every visible object submit a packet to the pass's render queue.
+// The sorted queue is streamed as the pass's draw index list, followed by
+// its commands.
+void MyWindow::prepareDraws(int pass)
+{
+    int nObjects = mObjects.size();
+
+    if (!mOptions.frustumCulling) {
+        mVisible.fill(1);
+        mVisibleCount[pass] = nObjects;
+    } else if (pass == 0 && mOptions.cascades > 0) {
+        // A caster is drawn when any of the cascades sees it
+        QVector<unsigned char> inCascade(nObjects);
+        mVisible.fill(0);
+        for (int c = 0; c < mOptions.cascades; c++)
+        {
+            QVector4D planes[6];
+            Frustum::extractPlanes(CascadeViewProj[c], planes);
+            BoundsCuller::cull(mWorldBounds, planes, inCascade.data());
+            for (int i = 0; i < nObjects; i++)
+                mVisible[i] |= inCascade[i];
+        }
+        mVisibleCount[pass] = nObjects - mVisible.count(0);
+    } else {
+        // The light or camera matrices of the pass are already set
+        QVector4D planes[6];
+        Frustum::extractPlanes(ProjectionMatrix * ViewMatrix, planes);
+        mVisibleCount[pass] = BoundsCuller::cull(mWorldBounds, planes, mVisible.data());
+    }
+
+    // The shadow pass measures cascades in the finest one
+    QMatrix4x4 viewProj = pass == 0 && mOptions.cascades > 0 ? CascadeViewProj[0] : ProjectionMatrix * ViewMatrix;
+    QVector<unsigned char> &lods = mObjectLod[pass];
+    if (mOptions.meshLod)
+        selectLods(pass, viewProj, pass == 0 ? shadowMapHeight : height());
+    else
+        lods.fill(0);
+
+    // The moments of VSM/ESM come from the fragment stage of the depth programs
+    bool depthProgram = mOptions.depthOnlyShadowPass || mOptions.shadowFilter != "pcf";
+    bool depthOnly = pass == 0 && (depthProgram || mOptions.cascades > 0);
+    int program = pass == 1 ? PROGRAM_LIT : mOptions.cascades > 0 ? PROGRAM_CASCADE
+                : depthProgram ? PROGRAM_DEPTH : PROGRAM_LIT;
+    // The shadow pass always draws patches with the depth-only variant
+    int tessProgram = pass == 1 ? PROGRAM_TESS : mOptions.cascades > 0 ? PROGRAM_TESS_CASCADE : PROGRAM_TESS_DEPTH;
+    int vao = depthOnly ? VAO_DEPTH : VAO_LIT;
+    int mask = pass == 0 ? SHADOW_PASS : LIT_PASS;
+
+    RenderQueue &queue = mQueue[pass];
+    queue.clear();
+    QVector4D row2 = viewProj.row(2), row3 = viewProj.row(3);
+    for (int i = 0; i < nObjects; i++)
+    {
+        const SceneObject &object = mObjects[i];
+        if (!mVisible[i] || !(object.passes & mask))
+            continue;
+
+        // Window depth of the box center, front to back within a mesh
+        QVector4D center(mWorldBounds.cx[i], mWorldBounds.cy[i], mWorldBounds.cz[i], 1.0f);
+        float w = QVector4D::dotProduct(row3, center);
+        float depth = 0.5f * QVector4D::dotProduct(row2, center) / qMax(w, 1.0e-4f) + 0.5f;
+
+        // GPU tessellated teapots are drawn from the patches instead, at
+        // their own level of detail
+        if (mOptions.gpuTessellation && object.mesh.firstIndex == mTeapotRange.firstIndex)
+            queue.submit(RenderQueue::makeKey(tessProgram, VAO_PATCHES, 0, mObjectMaterial[i], depth), i);
+        else
+            queue.submit(RenderQueue::makeKey(program, vao, mObjectMesh[i] + lods[i], mObjectMaterial[i], depth), i);
+    }
+    queue.build(mMeshTable);
+
+    const QVector<DrawElementsIndirectCommand> &commands = queue.commands();
+    const QVector<RenderQueue::Batch> &batches = queue.batches();
+    mTriangleCount[pass] = 0;
+    for (int b = 0; b < batches.size(); b++)
+    {
+        if (batches[b].vao == VAO_PATCHES)
+            continue;
+        for (int i = batches[b].firstCommand; i < batches[b].firstCommand + batches[b].commands; i++)
+            mTriangleCount[pass] += (qint64)(commands[i].count / 3) * commands[i].instanceCount;
+    }
+    mDrawCalls[pass] = 0;
+
+    // Both go to this frame's region of the stream buffer, baseInstance
+    // counts from the start of the pass's list
+    const QVector<GLuint> &indices = queue.drawIndices();
+    mDrawIndexOffset[pass] = mStream->write(indices.constData(), indices.size() * sizeof(GLuint), sizeof(GLuint));
+    mIndirectOffset[pass] = mStream->write(commands.constData(), commands.size() * sizeof(DrawElementsIndirectCommand),
+                                           sizeof(GLuint));
+}
+
+// Splits the camera frustum into slices and fits an orthographic light
+// frustum around each of them
+void MyWindow::updateCascades(const QVector3D &cameraPos, const QVector3D &cameraTarget, float aspect)
+{
+    const float nearDist = 0.1f;
+    const float farDist  = mOptions.cascadeFar;
+    const float lambda   = mOptions.cascadeLambda;
+
+    QVector3D up(0.0f, 1.0f, 0.0f);
+    float splitNear = nearDist;
+
+    for (int i = 0; i < mOptions.cascades; i++)
+    {
+        // Practical split scheme: lambda blends logarithmic and uniform splits
+        float t = (i + 1) / (float)mOptions.cascades;
+        float logSplit = nearDist * powf(farDist / nearDist, t);
+        float uniSplit = nearDist + (farDist - nearDist) * t;
+        float splitFar = lambda * logSplit + (1.0f - lambda) * uniSplit;
+
+        Frustum slice(Projection::PERSPECTIVE);
+        slice.orient(cameraPos, cameraTarget, up);
+        slice.setPerspective(50.0f, aspect, splitNear, splitFar);
+
+        Frustum cascade(Projection::ORTHO);
+        cascade.orient(lightFrustum->getOrigin(), QVector3D(0.0f, 0.0f, 0.0f), up);
+        cascade.enclose(slice);
+        // Casters between the light and the slice must not be clipped
+        cascade.setDepthRange(qMin(cascade.getNear(), 0.0f), cascade.getFar());
+
+        QMatrix4x4 viewProj = cascade.getProjectionMatrix() * cascade.getViewMatrix();
+        if (viewProj != CascadeViewProj[i]) {
+            CascadeViewProj[i] = viewProj;
+            mShadowDirty = true;
+        }
+        CascadeSplits[i] = splitFar;
+
+        splitNear = splitFar;
+    }
+}
+
+void MyWindow::setModelMatrix(int index, const QMatrix4x4 &model)
+{
+    mObjects[index].model = model;
+    mObjectsDirty = true;
+    mShadowDirty = true;
+}
+
 void MyWindow::resizeEvent(QResizeEvent *)
 {
     mUpdateSize = true;
@@ -297,8 +955,20 @@ void MyWindow::render()
         mUpdateSize = false;
     }
 
+    if (mUpdateShadowMap) {
+        setupFBO();
+        printf("Shadow map %dx%d, depth %s, %.1f MB\n", shadowMapWidth, shadowMapHeight,
+               mOptions.shadowFormat.toLatin1().constData(), mShadowTarget->getBytes() / 1048576.0);
+        mUpdateShadowMap = false;
+    }
+
+    // The timer loop keeps advancing its own tick count
+    if (!mTimerLoop)
+        currentTimeS = mClock.nsecsElapsed() / 1.0e9;
+
     //shadowMap();
     renderScene();
+    reportFrameLoop();
 }
 
 void MyWindow::renderScene()
@@ -315,169 +985,738 @@ void MyWindow::renderScene()
     float c = 1.0f;
     QVector3D cameraPos(c * 11.5f * cos(angle),c * 7.0f,c * 11.5f * sin(angle));
 
-    //Pass 1 - render shadow map
-    ViewMatrix.setToIdentity();
-    ViewMatrix = lightFrustum->getViewMatrix();
-    ProjectionMatrix.setToIdentity();
-    ProjectionMatrix = lightFrustum->getProjectionMatrix();
+    mGpuTimer->beginFrame();
+    mStream->beginFrame();
+
+    // Nothing is assumed about the state left by the previous frame
+    mState->setCaching(mOptions.glStateCache);
+    mState->invalidate();
+    mState->resetCounts();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glViewport(0,0,shadowMapWidth,shadowMapHeight);
-    mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass1Index);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    QElapsedTimer passTimer;
+    passTimer.start();
 
-    drawscene();
+    if (mObjectsDirty)
+        updateObjectBuffer();
+
+    //Pass 1 - render shadow map, only when something it depends on changed
+    if (lightFrustum->getVersion() != mShadowLightVersion) {
+        LightPV = shadowBias * lightFrustum->getProjectionMatrix() * lightFrustum->getViewMatrix();
+        mShadowLightVersion = lightFrustum->getVersion();
+        mShadowDirty = true;
+    }
+
+    float aspect = (float)this->width()/(float)this->height();
+    if (mOptions.cascades > 0)
+        updateCascades(cameraPos, QVector3D(0.0f, 0.0f, 0.0f), aspect);
+
+    if (mShadowDirty || !mOptions.shadowCache) {
+        ViewMatrix.setToIdentity();
+        ViewMatrix = lightFrustum->getViewMatrix();
+        ProjectionMatrix.setToIdentity();
+        ProjectionMatrix = lightFrustum->getProjectionMatrix();
+
+        mState->bindFramebuffer(mShadowTarget->getFramebuffer());
+        glClear(GL_DEPTH_BUFFER_BIT);
+        if (mShadowTarget->getMomentsTexture() != 0) {
+            // The moments of the far plane, where nothing casts a shadow
+            GLfloat farMoments[] = { 1.0f, 1.0f, 0.0f, 0.0f };
+            if (mOptions.shadowFilter == "esm")
+                farMoments[0] = exp(mOptions.esmExponent);
+            mFuncs->glClearBufferfv(GL_COLOR, 0, farMoments);
+        }
+        mState->viewport(0, 0, shadowMapWidth, shadowMapHeight);
+        mState->setEnabled(GL_CULL_FACE, true);
+        mState->cullFace(GL_FRONT);
+
+        mPassName = "shadow";
+        GlCallStats::setPass(GlCallStats::SHADOW_PASS);
+
+        if (mOptions.cascades > 0) {
+            // All cascades in one geometry pass, the geometry shader routes
+            // each triangle to the layers. Timing cascades individually
+            // needs one pass per cascade instead.
+            uploadUniforms(0);
+            prepareDraws(0);
+
+            int passes = mOptions.perCascadeTiming ? mOptions.cascades : 1;
+            for (int i = 0; i < passes; i++)
+            {
+                // The queue sets the range on the cascade programs it binds
+                mCascadeFirst = mOptions.perCascadeTiming ? i : 0;
+                mCascadeCount = mOptions.perCascadeTiming ? 1 : mOptions.cascades;
+
+                if (!mOptions.perDrawGpuTiming)
+                    mGpuTimer->begin(mOptions.perCascadeTiming ? QString("shadow/cascade%1").arg(i) : QString(mPassName));
+                drawscene(0);
+                mGpuTimer->end();
+            }
+        } else {
+            uploadUniforms(0);
+            prepareDraws(0);
+
+            if (!mOptions.perDrawGpuTiming) mGpuTimer->begin(mPassName);
+            drawscene(0);
+            mGpuTimer->end();
+
+            if (mShadowTarget->getMomentsTexture() != 0) {
+                mGpuTimer->begin("shadow/blur");
+                blurShadowMap();
+                mGpuTimer->end();
+            }
+        }
+
+        mShadowDirty = false;
+        mShadowCacheMisses++;
+    } else {
+        mShadowCacheHits++;
+    }
+
+    shadowPassNs = passTimer.nsecsElapsed();
+    passTimer.restart();
 
     //Pass 2 - actual render
 
     ViewMatrix.setToIdentity();
     ViewMatrix.lookAt(cameraPos,QVector3D(0.0f, 0.0f, 0.0f),QVector3D(0.0f,1.0f,0.0f));
     ProjectionMatrix.setToIdentity();
-    ProjectionMatrix.perspective(50.0f, (float)this->width()/(float)this->height(), 0.1f, 100.0f);
+    ProjectionMatrix.perspective(50.0f, aspect, 0.1f, 100.0f);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    mState->bindFramebuffer(defaultFramebuffer());
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0,0,this->width(), this->height());
-    mFuncs->glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &pass2Index);
-    glDisable(GL_CULL_FACE);
+    mState->viewport(0, 0, this->width(), this->height());
+    mState->setEnabled(GL_CULL_FACE, false);
+
+    uploadUniforms(1);
+    prepareDraws(1);
+
+    mPassName = "lit";
+    GlCallStats::setPass(GlCallStats::LIT_PASS);
+    if (!mOptions.perDrawGpuTiming) mGpuTimer->begin(mPassName);
+    drawscene(1);
+    mGpuTimer->end();
+
+    litPassNs = passTimer.nsecsElapsed();
 
-    drawscene();
+    // Read back before the swap, the back buffer is undefined after it
+    if (mCapture != 0)
+        mCapture->capture(defaultFramebuffer(), width(), height(),
+                          mHeadless ? mOffscreenFBO->format().samples() : 0);
 
-    mContext->swapBuffers(this);
+    mStream->endFrame();
+    mGpuTimer->endFrame();
+
+    if (!mHeadless)
+        mContext->swapBuffers(this);
+
+    GlCallStats::endFrame();
+    if (!mHeadless)
+        GlCallStats::report(5000);
 }
 
-void MyWindow::drawscene()
+int MyWindow::runBenchmark(int frames, int warmupFrames)
 {
-    QVector3D color(0.7f,0.5f,0.3f);
+    if (!mHeadless) {
+        qWarning( "The benchmark only runs in headless mode" );
+        return 1;
+    }
 
-    // *** Draw teapot
-    mFuncs->glBindVertexArray(mVAOTeapot);
+    QOpenGLFramebufferObjectFormat fboFormat;
+    fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    fboFormat.setSamples(format().samples());
+    mOffscreenFBO = new QOpenGLFramebufferObject(size(), fboFormat);
+    if (!mOffscreenFBO->isValid()) {
+        qWarning( "Could not create the offscreen framebuffer" );
+        return 1;
+    }
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    printf("Renderer: %s (%s)\n", (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
 
-    mProgram->bind();
-    {        
+    initialize();
 
-        QMatrix4x4 mv1 = ViewMatrix * ModelMatrixTeapot;
-        mProgram->setUniformValue("ModelViewMatrix", mv1);
-        mProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mv1);
+    printf("Frames: %d at %dx%d, shadow map %dx%d depth %s, teapot grid %d\n",
+           frames, width(), height(), shadowMapWidth, shadowMapHeight, mOptions.shadowFormat.toLatin1().constData(),
+           mOptions.teapotGrid);
 
-        mProgram->setUniformValue("ShadowMatrix", LightPV * ModelMatrixTeapot);
-        mProgram->setUniformValue("ShadowMap", 0);
+    if (mOptions.sweep.isEmpty()) {
+        printBenchResult("default", measure(frames, warmupFrames));
+        QStringList scopes = mGpuTimer->scopes();
+        for (int i = 0; i < scopes.size(); i++) {
+            const FrameStats &gpu = mGpuTimer->stats(scopes[i]);
+            printf("  GPU %-16s (ms): mean %.3f  p50 %.3f  p99 %.3f\n", scopes[i].toLatin1().constData(),
+                   gpu.mean(), gpu.percentile(50.0), gpu.percentile(99.0));
+        }
+    } else if (mOptions.sweep == "depth-program") {
+        // Shadow pass with the full scene program against the depth-only
+        // program, redrawn every frame so the timed frames include it
+        mOptions.shadowCache = false;
+        mOptions.depthOnlyShadowPass = false;
+        printBenchResult("full program", measure(frames, warmupFrames));
+        mOptions.depthOnlyShadowPass = true;
+        printBenchResult("depth-only program", measure(frames, warmupFrames));
+    } else if (mOptions.sweep == "shadow-cache") {
+        mOptions.shadowCache = false;
+        printBenchResult("shadow map every frame", measure(frames, warmupFrames));
+        mOptions.shadowCache = true;
+        printBenchResult("cached shadow map", measure(frames, warmupFrames));
+    } else if (mOptions.sweep == "pcf") {
+        // Every kernel against several shadow map sizes, the programs and
+        // the shadow map are rebuilt for each combination
+        const char *kernels[] = { "none", "2x2", "3x3", "5x5", "poisson" };
+        const int sizes[] = { 512, 1024, 2048, 4096 };
+        for (int s = 0; s < 4; s++) {
+            for (int k = 0; k < 5; k++) {
+                mOptions.pcfKernel = kernels[k];
+                shadowMapWidth = shadowMapHeight = sizes[s];
+                setupFBO();
+                initShaders();
+                printBenchResult(QString("pcf %1, shadow map %2").arg(kernels[k]).arg(sizes[s]), measure(frames, warmupFrames));
+            }
+        }
+    } else if (mOptions.sweep == "shadow-filter") {
+        // PCF grids against VSM and ESM blurred over the same width. The
+        // shadow map is redrawn every frame so the blur is in every frame.
+        if (mOptions.cascades > 0) {
+            qWarning() << "The shadow-filter sweep needs the single shadow map, not --cascades";
+            return 1;
+        }
+        const int radii[] = { 1, 2, 4 };
+        const char *filters[] = { "pcf", "vsm", "esm" };
+        QStringList labels;
+        QVector<BenchResult> results;
+        mOptions.shadowCache = false;
+        for (int r = 0; r < 3; r++) {
+            for (int f = 0; f < 3; f++) {
+                mOptions.shadowFilter = filters[f];
+                mOptions.pcfKernel = QString("%1x%1").arg(2 * radii[r] + 1);
+                mOptions.shadowBlur = radii[r];
+                setupFBO();
+                initShaders();
+                labels.append(f == 0 ? QString("pcf %1").arg(mOptions.pcfKernel)
+                                     : QString("%1, blur %2").arg(filters[f]).arg(mOptions.pcfKernel));
+                results.append(measure(frames, warmupFrames));
+                printBenchResult(labels.last(), results.last());
+            }
+        }
 
-        mProgram->setUniformValue("Light.Position", ViewMatrix * QVector4D(lightFrustum->getOrigin(), 1.0f));
-        mProgram->setUniformValue("Light.Intensity", QVector3D(0.85f, 0.85f, 0.85f));
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+        // Lit pass cost per pixel, where the filter is paid
+        double pixels = (double)width() * height();
+        printf("\n%-16s %12s %12s %14s %12s\n", "filter", "shadow GPU", "blur GPU", "lit ns/pixel", "frame ms");
+        for (int i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            printf("%-16s %12.3f %12.3f %14.3f %12.3f\n", labels[i].toLatin1().constData(), r.shadowGpu.mean(),
+                   r.blurGpu.mean(), r.litGpu.mean() * 1.0e6 / pixels, r.frameTime.mean());
+        }
+    } else if (mOptions.sweep == "shadow-format") {
+        // Depth precision against resolution: the shadow pass is redrawn
+        // every frame, the target reallocated for each combination
+        const char *formats[] = { "16", "24", "32f" };
+        const int sizes[] = { 512, 1024, 2048, 4096 };
+        QStringList labels;
+        QVector<BenchResult> results;
+        mOptions.shadowCache = false;
+        for (int s = 0; s < 4; s++) {
+            for (int f = 0; f < 3; f++) {
+                mOptions.shadowFormat = formats[f];
+                shadowMapWidth = shadowMapHeight = sizes[s];
+                setupFBO();
+                labels.append(QString("depth %1, %2").arg(formats[f]).arg(sizes[s]));
+                results.append(measure(frames, warmupFrames));
+                printBenchResult(labels.last(), results.last());
+            }
+        }
 
-        mProgram->setUniformValue("Material.Ka", color * 0.05f);
-        mProgram->setUniformValue("Material.Kd", color);
-        mProgram->setUniformValue("Material.Ks", 0.9f, 0.9f, 0.9f);
-        mProgram->setUniformValue("Material.Shininess", 150.0f);
+        printf("\n%-16s %10s %12s %12s %12s\n", "shadow map", "MB", "shadow GPU", "shadow CPU", "frame ms");
+        for (int i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            printf("%-16s %10.1f %12.3f %12.3f %12.3f\n", labels[i].toLatin1().constData(), r.shadowMapMB,
+                   r.shadowGpu.mean(), r.shadowCpu.mean(), r.frameTime.mean());
+        }
+    } else if (mOptions.sweep == "stress") {
+        // Scene size against frame cost, the shadow map is redrawn every
+        // frame so both passes are measured
+        const int counts[] = { 1, 10, 100, 1000, 10000, 100000 };
+        QVector<BenchResult> results;
+        mOptions.shadowCache = false;
+        for (int i = 0; i < 6; i++) {
+            mOptions.stressCount = counts[i];
+            initScene();
+            initUniformBuffers();
+            results.append(measure(frames, warmupFrames));
+            printBenchResult(QString("stress %1 objects").arg(counts[i]), results.last());
+        }
 
-        glDrawElements(GL_TRIANGLES, 6 * mTeapot->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+        printf("\n%8s %10s %12s %12s %12s %12s\n", "objects", "frame ms", "shadow CPU", "lit CPU", "shadow GPU", "lit GPU");
+        for (int i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            printf("%8d %10.3f %12.3f %12.3f %12.3f %12.3f\n", counts[i], r.frameTime.mean(),
+                   r.shadowCpu.mean(), r.litCpu.mean(), r.shadowGpu.mean(), r.litGpu.mean());
+        }
+    } else if (mOptions.sweep == "tessellation") {
+        // The teapot tessellated on the CPU at the fixed grid against the
+        // patches tessellated on the GPU at several target edge sizes. The
+        // shadow map is redrawn every frame so its coarser level is timed.
+        mOptions.shadowCache = false;
+        mOptions.gpuTessellation = false;
+        printBenchResult(QString("CPU mesh, grid %1").arg(mOptions.teapotGrid), measure(frames, warmupFrames));
+        const float pixels[] = { 16.0f, 8.0f, 4.0f, 2.0f };
+        mOptions.gpuTessellation = true;
+        for (int i = 0; i < 4; i++) {
+            mOptions.tessPixelsPerEdge = pixels[i];
+            printBenchResult(QString("GPU patches, %1 px per edge, shadow level x%2").arg(pixels[i]).arg(mOptions.tessShadowScale),
+                             measure(frames, warmupFrames));
+        }
+    } else if (mOptions.sweep == "lod") {
+        // Finest meshes only against LOD selection at several switch sizes,
+        // with the shadow map redrawn every frame
+        mOptions.shadowCache = false;
+        mOptions.meshLod = false;
+        printBenchResult("LOD off", measure(frames, warmupFrames));
+        const float pixels[] = { 512.0f, 256.0f, 128.0f, 64.0f };
+        mOptions.meshLod = true;
+        for (int i = 0; i < 4; i++) {
+            mOptions.lodPixels = pixels[i];
+            printBenchResult(QString("LOD at %1 px, shadow bias %2").arg(pixels[i]).arg(mOptions.shadowLodBias),
+                             measure(frames, warmupFrames));
+        }
+    } else {
+        qWarning() << "Unknown sweep" << mOptions.sweep;
+        return 1;
+    }
+
+    return 0;
+}
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
+MyWindow::BenchResult MyWindow::measure(int frames, int warmupFrames)
+{
+    BenchResult result;
+    QElapsedTimer frameTimer, totalTimer;
+    double shadowVisible = 0.0, litVisible = 0.0;
+    int shadowFrames = 0;
+    double shadowTriangles = 0.0, litTriangles = 0.0;
+    double glCalls = 0.0, glRedundant = 0.0;
+    double packets[2] = { 0.0, 0.0 }, switches[2] = { 0.0, 0.0 }, draws[2] = { 0.0, 0.0 };
+
+    int gpuDropped = 0;
+
+    // Every run starts from an empty shadow cache
+    mShadowDirty = true;
+
+    for (int i = -warmupFrames; i < frames; i++)
+    {
+        if (i == 0) {
+            // Drop the GPU timings of the warmup frames
+            mGpuTimer->flush();
+            mGpuTimer->reset();
+            gpuDropped = mGpuTimer->getDroppedFrames();
+            mShadowCacheHits = mShadowCacheMisses = 0;
+            mStream->resetStats();
+            GlCallStats::reset();
+            totalTimer.start();
+        }
+
+        // Fixed time step so the camera orbit is identical from run to run
+        currentTimeS = (warmupFrames + i + 1) / 60.0;
+
+        int shadowMisses = mShadowCacheMisses;
+        frameTimer.start();
+        renderScene();
+        glFinish();
+        double ms = frameTimer.nsecsElapsed() / 1.0e6;
+
+        if (i >= 0) {
+            result.frameTime.add(ms);
+            result.shadowCpu.add(shadowPassNs / 1.0e6);
+            result.litCpu.add(litPassNs / 1.0e6);
+            // The shadow pass counts are left over from the last redraw on
+            // frames that took the cached shadow map
+            if (mShadowCacheMisses != shadowMisses) {
+                shadowVisible += mVisibleCount[0];
+                shadowTriangles += mTriangleCount[0];
+                shadowFrames++;
+            }
+            litVisible += mVisibleCount[1];
+            litTriangles += mTriangleCount[1];
+            glCalls += mState->getCalls();
+            glRedundant += mState->getRedundant();
+            // The shadow queue is only rebuilt and replayed on a redraw too
+            for (int pass = mShadowCacheMisses != shadowMisses ? 0 : 1; pass < 2; pass++)
+            {
+                packets[pass] += mQueue[pass].getPackets();
+                switches[pass] += mQueue[pass].getSwitches();
+                draws[pass] += mDrawCalls[pass];
+            }
+        }
+    }
+
+    result.fps = frames / (totalTimer.nsecsElapsed() / 1.0e9);
+
+    mGpuTimer->flush();
+    result.shadowGpu = mGpuTimer->stats("shadow");
+    result.litGpu = mGpuTimer->stats("lit");
+    result.blurGpu = mGpuTimer->stats("shadow/blur");
+    result.gpuDropped = mGpuTimer->getDroppedFrames() - gpuDropped;
+    result.shadowMapMB = mShadowTarget->getBytes() / 1048576.0;
+    result.shadowCacheHits = mShadowCacheHits;
+    result.shadowCacheMisses = mShadowCacheMisses;
+    result.shadowVisible = shadowVisible / qMax(1, shadowFrames);
+    result.litVisible = litVisible / qMax(1, frames);
+    result.shadowTriangles = shadowTriangles / qMax(1, shadowFrames);
+    result.glStateCalls = glCalls / qMax(1, frames);
+    result.glStateRedundant = glRedundant / qMax(1, frames);
+    result.glCalls = GlCallStats::mean();
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int passFrames = pass == 0 ? shadowFrames : frames;
+        result.queuePackets[pass] = packets[pass] / qMax(1, passFrames);
+        result.queueSwitches[pass] = switches[pass] / qMax(1, passFrames);
+        result.queueDraws[pass] = draws[pass] / qMax(1, passFrames);
     }
-    mProgram->release();
+    result.streamStalls = mStream->getStalls();
+    result.streamStallMs = mStream->getStallMs();
+    result.litTriangles = litTriangles / qMax(1, frames);
+
+    tPrev = 0.0f;
+
+    return result;
+}
 
-    // *** Draw planes
-    mFuncs->glBindVertexArray(mVAOPlane);
+void MyWindow::printBenchResult(const QString &label, const BenchResult &r)
+{
+    printf("[%s]\n", label.toLatin1().constData());
+    printf("  Throughput: %.1f frames/s\n", r.fps);
+    printf("  Frame time (ms):      mean %.3f  p50 %.3f  p99 %.3f  min %.3f  max %.3f\n",
+           r.frameTime.mean(), r.frameTime.percentile(50.0), r.frameTime.percentile(99.0), r.frameTime.min(), r.frameTime.max());
+    printf("  Shadow pass CPU (ms): mean %.3f  p50 %.3f  p99 %.3f\n",
+           r.shadowCpu.mean(), r.shadowCpu.percentile(50.0), r.shadowCpu.percentile(99.0));
+    printf("  Lit pass CPU (ms):    mean %.3f  p50 %.3f  p99 %.3f\n",
+           r.litCpu.mean(), r.litCpu.percentile(50.0), r.litCpu.percentile(99.0));
+    if (r.shadowGpu.count() > 0)
+        printf("  Shadow pass GPU (ms): mean %.3f  p50 %.3f  p99 %.3f\n",
+               r.shadowGpu.mean(), r.shadowGpu.percentile(50.0), r.shadowGpu.percentile(99.0));
+    if (r.litGpu.count() > 0)
+        printf("  Lit pass GPU (ms):    mean %.3f  p50 %.3f  p99 %.3f\n",
+               r.litGpu.mean(), r.litGpu.percentile(50.0), r.litGpu.percentile(99.0));
+    if (r.blurGpu.count() > 0)
+        printf("  Shadow blur GPU (ms): mean %.3f  p50 %.3f  p99 %.3f\n",
+               r.blurGpu.mean(), r.blurGpu.percentile(50.0), r.blurGpu.percentile(99.0));
+    // Every frame is finished before the next one starts, so the timer
+    // ring must never have to drop one
+    if (r.gpuDropped > 0)
+        qWarning("GPU timer dropped %d of the measured frames although the GPU kept up", r.gpuDropped);
+    printf("  Shadow map: %dx%d, depth %s, %.1f MB\n", shadowMapWidth, shadowMapHeight,
+           mOptions.shadowFormat.toLatin1().constData(), r.shadowMapMB);
+    printf("  Shadow cache: %d hits, %d misses (%.1f%% hit rate)\n", r.shadowCacheHits, r.shadowCacheMisses,
+           100.0 * r.shadowCacheHits / qMax(1, r.shadowCacheHits + r.shadowCacheMisses));
+    printf("  Objects drawn: shadow %.1f per redraw, lit %.1f of %d (culling %s, %s)\n", r.shadowVisible, r.litVisible,
+           mObjects.size(), mOptions.frustumCulling ? "on" : "off", BoundsCuller::simdName());
+    printf("  Mesh triangles drawn: shadow %.0f per redraw, lit %.0f (LOD %s)\n", r.shadowTriangles, r.litTriangles,
+           mOptions.meshLod ? "on" : "off");
+    printf("  Render queue: shadow %.1f packets, %.1f switches, %.1f draws per redraw; lit %.1f packets, %.1f switches, %.1f draws\n",
+           r.queuePackets[0], r.queueSwitches[0], r.queueDraws[0], r.queuePackets[1], r.queueSwitches[1], r.queueDraws[1]);
+    if (GlCallStats::enabled()) {
+        const GlCallStats::Frame &c = r.glCalls;
+        printf("  GL calls per frame: %.0f bind, %.0f state, %.0f uniform, %.0f upload, %.0f draw, %.0f sync; %.1f KB uploaded\n",
+               c.calls[GlCallStats::BIND], c.calls[GlCallStats::STATE], c.calls[GlCallStats::UNIFORM],
+               c.calls[GlCallStats::UPLOAD], c.calls[GlCallStats::DRAW], c.calls[GlCallStats::SYNC], c.uploadBytes / 1024.0);
+        printf("  GL draws per frame: shadow %.1f (%.0f triangles), lit %.1f (%.0f triangles)\n",
+               c.draws[GlCallStats::SHADOW_PASS], c.triangles[GlCallStats::SHADOW_PASS],
+               c.draws[GlCallStats::LIT_PASS], c.triangles[GlCallStats::LIT_PASS]);
+    }
+    printf("  GL state calls per frame: %.1f, %.1f redundant (%s)\n", r.glStateCalls, r.glStateRedundant,
+           mOptions.glStateCache ? "elided" : "issued, state cache off");
+    printf("  Stream buffer: %d x %.1f KB regions, %d fence stalls (%.3f ms waited)\n", mStream->getRegions(),
+           mStream->getRegionSize() / 1024.0, r.streamStalls, r.streamStallMs);
+}
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+void MyWindow::uploadUniforms(int pass)
+{
+    // Per-frame block: view, projection and light, one slot per pass
+    FrameUniforms frame;
+    memcpy(frame.ViewMatrix, ViewMatrix.constData(), sizeof(frame.ViewMatrix));
+    memcpy(frame.ProjectionMatrix, ProjectionMatrix.constData(), sizeof(frame.ProjectionMatrix));
+    memcpy(frame.ViewProjectionMatrix, (ProjectionMatrix * ViewMatrix).constData(), sizeof(frame.ViewProjectionMatrix));
+    memcpy(frame.ShadowMatrix, LightPV.constData(), sizeof(frame.ShadowMatrix));
+    // Cascades are fitted for a directional light shining from the light position
+    QVector4D lightPos = ViewMatrix * QVector4D(lightFrustum->getOrigin(), mOptions.cascades > 0 ? 0.0f : 1.0f);
+    frame.LightPosition[0] = lightPos.x();
+    frame.LightPosition[1] = lightPos.y();
+    frame.LightPosition[2] = lightPos.z();
+    frame.LightPosition[3] = lightPos.w();
+    frame.LightIntensity[0] = frame.LightIntensity[1] = frame.LightIntensity[2] = 0.85f;
+    frame.LightIntensity[3] = 1.0f;
+    for (int i = 0; i < MAX_CASCADES; i++) {
+        memcpy(frame.CascadeViewProj[i], CascadeViewProj[i].constData(), sizeof(frame.CascadeViewProj[i]));
+        memcpy(frame.CascadeShadowMatrix[i], (shadowBias * CascadeViewProj[i]).constData(), sizeof(frame.CascadeShadowMatrix[i]));
+        frame.CascadeSplits[i] = CascadeSplits[i];
+    }
+    // A larger target edge lowers the tessellation level of the shadow pass
+    frame.TessParams[0] = pass == 0 ? shadowMapWidth : width();
+    frame.TessParams[1] = pass == 0 ? shadowMapHeight : height();
+    frame.TessParams[2] = mOptions.tessPixelsPerEdge / (pass == 0 ? mOptions.tessShadowScale : 1.0f);
+    frame.TessParams[3] = 64.0f;
+    // VSM/ESM depth is linear over the light range
+    frame.ShadowParams[0] = lightFrustum->getFar();
+    frame.ShadowParams[1] = mOptions.esmExponent;
+    frame.ShadowParams[2] = 1.0e-5f;
+    frame.ShadowParams[3] = 0.2f;
+
+    // Each pass gets a fresh block, the shadow pass may still be reading its own
+    GLintptr offset = mStream->write(&frame, sizeof(FrameUniforms), mUniformAlign);
+    if (offset >= 0)
+        mState->bindBufferRange(GL_UNIFORM_BUFFER, UniformBinding::FRAME, mStream->getBuffer(), offset, sizeof(FrameUniforms));
+}
 
-    mProgram->bind();
+// Object transforms live in world space, the view and projection of the
+// pass come from the frame block, so the buffer only changes when an
+// object moves
+void MyWindow::updateObjectBuffer()
+{
+    for (int i = 0; i < mObjects.size(); i++)
     {
-        mProgram->setUniformValue("Light.Position", ViewMatrix * QVector4D(lightFrustum->getOrigin(), 1.0f));
-        mProgram->setUniformValue("Light.Intensity", QVector3D(0.85f, 0.85f, 0.85f));
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+        const SceneObject &object = mObjects[i];
+        ObjectUniforms *block = (ObjectUniforms *)mObjectData.data() + i;
+
+        // Quantized positions are expanded by the mesh transform, the
+        // normals must not see its scale
+        QMatrix4x4 model = object.model * object.meshTransform;
+        QMatrix3x3 normal = object.model.normalMatrix();
+        memcpy(block->ModelMatrix, model.constData(), sizeof(block->ModelMatrix));
+        for (int c = 0; c < 3; c++)
+            memcpy(block->NormalMatrix + 4 * c, normal.constData() + 3 * c, 3 * sizeof(GLfloat));
+
+        QVector3D center, extent;
+        BoundsCuller::transformBounds(object.model, object.boundsCenter, object.boundsExtent, center, extent);
+        mWorldBounds.set(i, center, extent);
+    }
 
-        mProgram->setUniformValue("Material.Ka", 0.05f, 0.05f, 0.05f);
-        mProgram->setUniformValue("Material.Kd", 0.25f, 0.25f, 0.25f);
-        mProgram->setUniformValue("Material.Ks", 0.0f,  0.0f,  0.0f);
-        mProgram->setUniformValue("Material.Shininess", 1.0f);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mObjectData.size(), mObjectData.constData());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-        mProgram->setUniformValue("ShadowMap", 0);
-        for (int i=0; i<3; i++)
-        {
-            QMatrix4x4 mv1 = ViewMatrix * ModelMatrixPlane[i];
-            mProgram->setUniformValue("ModelViewMatrix", mv1);
-            mProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
-            mProgram->setUniformValue("MVP", ProjectionMatrix * mv1);
+    mObjectsDirty = false;
+}
 
-            mProgram->setUniformValue("ShadowMatrix", LightPV * ModelMatrixPlane[i]);
+// Replays the sorted queue of the pass. Programs and VAOs only change
+// between batches, each batch of triangles is one multi-draw.
+void MyWindow::drawscene(int pass)
+{
+    if (mDrawIndexOffset[pass] < 0 || mIndirectOffset[pass] < 0)
+        return;
 
-            glDrawElements(GL_TRIANGLES, 6 * mPlane->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    // Per-draw data comes from the storage buffer
+    mState->bindBufferBase(GL_SHADER_STORAGE_BUFFER, UniformBinding::OBJECTS, mObjectSSBO);
+    mState->bindBuffer(GL_DRAW_INDIRECT_BUFFER, mStream->getBuffer());
+
+    const RenderQueue &queue = mQueue[pass];
+    const QVector<RenderQueue::Batch> &batches = queue.batches();
+    const QVector<DrawElementsIndirectCommand> &commands = queue.commands();
+    int vao = -1;
+    for (int b = 0; b < batches.size(); b++)
+    {
+        const RenderQueue::Batch &batch = batches[b];
+        useDrawProgram(pass, batch.program);
+
+        if (batch.vao != vao) {
+            vao = batch.vao;
+            mState->bindVertexArray(vao == VAO_PATCHES ? mArena->getPatchVao()
+                                    : vao == VAO_DEPTH ? mArena->getDepthVao() : mArena->getVao());
+            mArena->bindDrawIndices(mStream->getBuffer(), mDrawIndexOffset[pass]);
         }
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
+        if (vao == VAO_PATCHES) {
+            drawPatches(pass, batch);
+        } else if (mOptions.perDrawGpuTiming) {
+            // A timer query cannot split a multi-draw, so the same commands
+            // are issued one at a time
+            for (int i = batch.firstCommand; i < batch.firstCommand + batch.commands; i++)
+                drawObject(mObjects[queue.drawIndices()[commands[i].baseInstance]].name, commands[i]);
+            mDrawCalls[pass] += batch.commands;
+        } else {
+            mFuncs->glMultiDrawElementsIndirect(GL_TRIANGLES, mArena->getIndexType(),
+                                                (GLubyte *)NULL + mIndirectOffset[pass]
+                                                + batch.firstCommand * sizeof(DrawElementsIndirectCommand),
+                                                batch.commands, 0);
+            mDrawCalls[pass]++;
+#ifdef GL_CALL_STATS
+            for (int i = batch.firstCommand; i < batch.firstCommand + batch.commands; i++)
+                GlCallStats::addTriangles((qint64)(commands[i].count / 3) * commands[i].instanceCount);
+#endif
+        }
     }
-    mProgram->release();
+}
 
-    // *** Draw torus
-    mFuncs->glBindVertexArray(mVAOTorus);
+// Binds a program named by a queue key, with what it needs from the pass
+void MyWindow::useDrawProgram(int pass, int program)
+{
+    switch (program) {
+    case PROGRAM_LIT:
+        // Subroutine selections are reset by glUseProgram, so set them after binding
+        mState->useProgram(mProgram->programId());
+        mState->uniformSubroutine(GL_FRAGMENT_SHADER, pass == 0 ? pass1Index : pass2Index);
+        break;
+    case PROGRAM_DEPTH:
+        mState->useProgram(mDepthProgram->programId());
+        break;
+    case PROGRAM_CASCADE:
+    case PROGRAM_TESS_CASCADE:
+        mState->useProgram(program == PROGRAM_CASCADE ? mCascadeProgram->programId() : mTessCascadeProgram->programId());
+        mState->uniform1i(0, mCascadeFirst);
+        mState->uniform1i(1, mCascadeCount);
+        break;
+    case PROGRAM_TESS:
+        mState->useProgram(mTessProgram->programId());
+        mState->uniformSubroutine(GL_FRAGMENT_SHADER, tessPass2Index);
+        break;
+    case PROGRAM_TESS_DEPTH:
+        mState->useProgram(mTessDepthProgram->programId());
+        break;
+    }
+}
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+// Teapots as bicubic patches, one instanced draw per command of the batch
+void MyWindow::drawPatches(int pass, const RenderQueue::Batch &batch)
+{
+    mState->patchVertices(16);
 
-    mProgram->bind();
+    const QVector<DrawElementsIndirectCommand> &commands = mQueue[pass].commands();
+    for (int i = batch.firstCommand; i < batch.firstCommand + batch.commands; i++)
     {
-        QMatrix4x4 mv1 = ViewMatrix * ModelMatrixTorus;
-        mProgram->setUniformValue("ModelViewMatrix", mv1);
-        mProgram->setUniformValue("NormalMatrix", mv1.normalMatrix());
-        mProgram->setUniformValue("MVP", ProjectionMatrix * mv1);
+        if (mOptions.perDrawGpuTiming)
+            mGpuTimer->begin(QString("%1/teapot patches").arg(mPassName));
 
-        mProgram->setUniformValue("ShadowMatrix", LightPV * ModelMatrixTorus);
-        mProgram->setUniformValue("ShadowMap", 0);
+        mFuncs->glDrawArraysInstancedBaseInstance(GL_PATCHES, mTeapotPatches.first, mTeapotPatches.count,
+                                                  commands[i].instanceCount, commands[i].baseInstance);
+        mDrawCalls[pass]++;
 
-        mProgram->setUniformValue("Light.Position", ViewMatrix * QVector4D(lightFrustum->getOrigin(), 1.0f));
-        mProgram->setUniformValue("Light.Intensity", QVector3D(0.85f, 0.85f, 0.85f));
-        mProgram->setUniformValue("ViewNormalMatrix", ViewMatrix.normalMatrix());
+        if (mOptions.perDrawGpuTiming)
+            mGpuTimer->end();
+    }
+}
 
-        mProgram->setUniformValue("Material.Ka", color * 0.05f);
-        mProgram->setUniformValue("Material.Kd", color);
-        mProgram->setUniformValue("Material.Ks", 0.9f, 0.9f, 0.9f);
-        mProgram->setUniformValue("Material.Shininess", 150.0f);
+void MyWindow::drawObject(const char *name, const DrawElementsIndirectCommand &cmd)
+{
+    if (mOptions.perDrawGpuTiming)
+        mGpuTimer->begin(QString("%1/%2").arg(mPassName).arg(name));
 
-        glDrawElements(GL_TRIANGLES, 6 * mTorus->getnFaces(), GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    GLsizeiptr indexSize = mArena->getIndexType() == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    mFuncs->glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, cmd.count, mArena->getIndexType(),
+                                                          ((GLubyte *)NULL + cmd.firstIndex * indexSize),
+                                                          cmd.instanceCount, cmd.baseVertex, cmd.baseInstance);
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-    }
-    mProgram->release();
+    if (mOptions.perDrawGpuTiming)
+        mGpuTimer->end();
+}
 
+const GpuTimer *MyWindow::gpuTimer() const
+{
+    return mGpuTimer;
 }
 
 void MyWindow::initShaders()
 {
-    QOpenGLShader vShader(QOpenGLShader::Vertex);
-    QOpenGLShader fShader(QOpenGLShader::Fragment);    
-    QFile         shaderFile;
-    QByteArray    shaderSource;
+    // Called again whenever a setting baked into the shaders changes
+    if (mProgram != 0) delete mProgram;
+    if (mDepthProgram != 0) delete mDepthProgram;
+    if (mCascadeProgram != 0) delete mCascadeProgram;
+    mCascadeProgram = 0;
+    delete mTessProgram;
+    delete mTessDepthProgram;
+    delete mTessCascadeProgram;
+    mTessCascadeProgram = 0;
+
+    // Binaries of earlier runs on the same driver skip compiling
+    if (!mOptions.programCacheDir.isEmpty() && mProgramCache == 0)
+        mProgramCache = new ProgramCache(mFuncs, mOptions.programCacheDir);
 
     //Simple ADS
-    shaderFile.setFileName(":/vshader.txt");
-    shaderFile.open(QIODevice::ReadOnly);
-    shaderSource = shaderFile.readAll();
-    shaderFile.close();
-    qDebug() << "vertex compile: " << vShader.compileSourceCode(shaderSource);
-
-    shaderFile.setFileName(":/fshader.txt");
-    shaderFile.open(QIODevice::ReadOnly);
-    shaderSource = shaderFile.readAll();
-    shaderFile.close();
-    qDebug() << "frag   compile: " << fShader.compileSourceCode(shaderSource);
+    ShaderBuilder scene, tessScene;
+    scene.addStage(QOpenGLShader::Vertex,   ":/vshader.txt")
+         .addStage(QOpenGLShader::Fragment, ":/fshader.txt");
+    // The teapot patches go through the same fragment stage
+    tessScene.addStage(QOpenGLShader::Vertex,                 ":/patchvshader.txt")
+             .addStage(QOpenGLShader::TessellationControl,    ":/patchtcshader.txt")
+             .addStage(QOpenGLShader::TessellationEvaluation, ":/patchteshader.txt")
+             .addStage(QOpenGLShader::Fragment,               ":/fshader.txt");
+
+    ShaderBuilder *variants[] = { &scene, &tessScene };
+    for (int i = 0; i < 2; i++)
+    {
+        ShaderBuilder &builder = *variants[i];
+        if (mOptions.cascades > 0)
+            builder.define("CASCADE_COUNT", mOptions.cascades);
+        // Each PCF kernel is its own program variant, no runtime branching
+        if (mOptions.pcfKernel == "2x2")
+            builder.define("PCF_HW2X2");
+        else if (mOptions.pcfKernel == "3x3")
+            builder.define("PCF_GRID_RADIUS", 1);
+        else if (mOptions.pcfKernel == "5x5")
+            builder.define("PCF_GRID_RADIUS", 2);
+        else if (mOptions.pcfKernel == "7x7")
+            builder.define("PCF_GRID_RADIUS", 3);
+        else if (mOptions.pcfKernel == "9x9")
+            builder.define("PCF_GRID_RADIUS", 4);
+        else if (mOptions.pcfKernel == "poisson")
+            builder.define("PCF_POISSON");
+    }
+    // VSM and ESM replace the PCF kernel
+    QString filter = QString("pcf %1").arg(mOptions.pcfKernel);
+    if (mOptions.shadowFilter != "pcf") {
+        QByteArray define = mOptions.shadowFilter == "vsm" ? "SHADOW_VSM" : "SHADOW_ESM";
+        scene.define(define);
+        tessScene.define(define);
+        filter = mOptions.shadowFilter;
+    }
+    mProgram = scene.link(QString("scene, %1").arg(filter).toLatin1().constData(), mProgramCache);
+    mTessProgram = tessScene.link(QString("tessellated scene, %1").arg(filter).toLatin1().constData(), mProgramCache);
 
-    mProgram = new (QOpenGLShaderProgram);
-    mProgram->addShader(&vShader);
-    mProgram->addShader(&fShader);
-    qDebug() << "shader link: " << mProgram->link();
+    pass1Index = mFuncs->glGetSubroutineIndex(mProgram->programId(), GL_FRAGMENT_SHADER, "recordDepth");
+    pass2Index = mFuncs->glGetSubroutineIndex(mProgram->programId(), GL_FRAGMENT_SHADER, "shadeWithShadow");
+    tessPass2Index = mFuncs->glGetSubroutineIndex(mTessProgram->programId(), GL_FRAGMENT_SHADER, "shadeWithShadow");
+
+    // Depth only, no fragment stage, unless VSM/ESM moments are written
+    ShaderBuilder depth, tessDepth;
+    depth.addStage(QOpenGLShader::Vertex, ":/depthvshader.txt");
+    tessDepth.addStage(QOpenGLShader::Vertex,                 ":/patchvshader.txt")
+             .addStage(QOpenGLShader::TessellationControl,    ":/patchtcshader.txt")
+             .addStage(QOpenGLShader::TessellationEvaluation, ":/patchteshader.txt")
+             .define("TESS_DEPTH");
+    if (mOptions.shadowFilter != "pcf") {
+        QByteArray define = mOptions.shadowFilter == "vsm" ? "SHADOW_VSM" : "SHADOW_ESM";
+        depth.addStage(QOpenGLShader::Fragment, ":/momentsfshader.txt").define(define);
+        tessDepth.addStage(QOpenGLShader::Fragment, ":/momentsfshader.txt").define(define);
+    }
+    mDepthProgram = depth.link("depth", mProgramCache);
+    mTessDepthProgram = tessDepth.link("tessellated depth", mProgramCache);
+
+    delete mBlurProgram;
+    mBlurProgram = 0;
+    if (mOptions.shadowFilter != "pcf")
+        mBlurProgram = ShaderBuilder()
+                .addStage(QOpenGLShader::Compute, ":/blurcshader.txt")
+                .define("BLUR_RADIUS", qMax(1, mOptions.shadowBlur))
+                .define("MOMENTS_FORMAT", mOptions.shadowFilter == "vsm" ? "rg32f" : "r32f")
+                .link("moments blur", mProgramCache);
+
+    // Layered depth only, one geometry shader instance per cascade
+    if (mOptions.cascades > 0)
+        mCascadeProgram = ShaderBuilder()
+                .addStage(QOpenGLShader::Vertex,   ":/cascadevshader.txt")
+                .addStage(QOpenGLShader::Geometry, ":/cascadegshader.txt")
+                .define("CASCADE_COUNT", mOptions.cascades)
+                .link("cascade depth", mProgramCache);
+    if (mOptions.cascades > 0)
+        mTessCascadeProgram = ShaderBuilder()
+                .addStage(QOpenGLShader::Vertex,                 ":/patchvshader.txt")
+                .addStage(QOpenGLShader::TessellationControl,    ":/patchtcshader.txt")
+                .addStage(QOpenGLShader::TessellationEvaluation, ":/patchteshader.txt")
+                .addStage(QOpenGLShader::Geometry,               ":/cascadegshader.txt")
+                .define("CASCADE_COUNT", mOptions.cascades)
+                .define("TESS_CASCADES")
+                .link("tessellated cascade depth", mProgramCache);
+
+    if (mProgramCache != 0)
+        mProgramCache->printSummary();
 }
 
 void MyWindow::PrepareTexture(GLenum TextureTarget, const QString& FileName, GLuint& TexObject, bool flip)
@@ -501,16 +1740,31 @@ void MyWindow::keyPressEvent(QKeyEvent *keyEvent)
         case Qt::Key_P:
             break;
         case Qt::Key_Up:
-            break;
         case Qt::Key_Down:
+            // Move the torus, the shadow map has to follow
+            if (!mObjects.isEmpty()) {
+                QMatrix4x4 model;
+                model.translate(0.0f, keyEvent->key() == Qt::Key_Up ? 0.25f : -0.25f, 0.0f);
+                setModelMatrix(mObjects.size() - 1, model * mObjects.last().model);
+            }
             break;
         case Qt::Key_Left:
-            break;
         case Qt::Key_Right:
+            // Orbit the light around the vertical axis
+            if (lightFrustum != 0) {
+                QMatrix4x4 rot;
+                rot.rotate(keyEvent->key() == Qt::Key_Left ? 5.0f : -5.0f, QVector3D(0.0f, 1.0f, 0.0f));
+                lightFrustum->orient(rot * lightFrustum->getOrigin(), QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f,1.0f,0.0f));
+            }
             break;
         case Qt::Key_Delete:
             break;
+        case Qt::Key_PageUp:
         case Qt::Key_PageDown:
+            // Double or halve the shadow map resolution, applied by the next frame
+            shadowMapWidth = shadowMapHeight = qBound(256, keyEvent->key() == Qt::Key_PageUp ? 2 * shadowMapWidth
+                                                                                           : shadowMapWidth / 2, 8192);
+            mUpdateShadowMap = true;
             break;
         case Qt::Key_Home:
             break;
@@ -521,6 +1775,9 @@ void MyWindow::keyPressEvent(QKeyEvent *keyEvent)
         case Qt::Key_S:
             break;
         case Qt::Key_D:
+            // Next shadow map depth format
+            mOptions.shadowFormat = mOptions.shadowFormat == "16" ? "24" : mOptions.shadowFormat == "24" ? "32f" : "16";
+            mUpdateShadowMap = true;
             break;
         case Qt::Key_A:
             break;
@@ -2,11 +2,14 @@
 #include <QTimer>
 #include <QString>
 #include <QKeyEvent>
+#include <QElapsedTimer>
 
 #include <QVector3D>
 #include <QMatrix4x4>
 
 #include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
 #include <QOpenGLFunctions>
 #include <QOpenGLFunctions_4_3_Core>
 
@@ -16,6 +19,21 @@
 #include "vboplane.h"
 #include "torus.h"
 #include "frustum.h"
+#include "framestats.h"
+#include "gputimer.h"
+#include "renderoptions.h"
+#include "uniformblocks.h"
+#include "packedmesh.h"
+#include "geometryarena.h"
+#include "boundsculler.h"
+#include "meshcache.h"
+#include "programcache.h"
+#include "streambuffer.h"
+#include "glstate.h"
+#include "renderqueue.h"
+#include "glcallstats.h"
+#include "framecapture.h"
+#include "shadowmaptarget.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -25,61 +43,211 @@
 #define ToDegree(x) ((x) * 180.0f / M_PI)
 #define TwoPI (float)(2 * M_PI)
 
+struct Material
+{
+    QVector3D Ka, Kd, Ks;
+    float     Shininess;
+};
+
+// Passes an object submits draw packets to
+enum PassMask
+{
+    SHADOW_PASS = 1,
+    LIT_PASS    = 2,
+    ALL_PASSES  = SHADOW_PASS | LIT_PASS
+};
+
+struct SceneObject
+{
+    const char *name;
+    MeshRange   mesh;           // Location in the geometry arena
+    QMatrix4x4  model;
+    QMatrix4x4  meshTransform;  // Expands quantized positions
+    Material    material;
+    QVector3D   boundsCenter;   // Box of the unquantized mesh, before model
+    QVector3D   boundsExtent;
+    int         passes;         // PassMask
+};
+
 //class MyWindow : public QWindow, protected QOpenGLFunctions_3_3_Core
-class MyWindow : public QWindow, protected QOpenGLFunctions
+class MyWindow : public QWindow, protected GlFunctions
 {
     Q_OBJECT
 
 public:
-    explicit MyWindow();
+    explicit MyWindow(bool headless = false, const RenderOptions &options = RenderOptions());
     ~MyWindow();
     virtual void keyPressEvent( QKeyEvent *keyEvent );    
 
+    int runBenchmark(int frames, int warmupFrames);
+
+    const GpuTimer *gpuTimer() const;
+
 private slots:
     void render();
 
 private:    
+    struct BenchResult {
+        FrameStats frameTime, shadowCpu, litCpu, shadowGpu, litGpu;
+        FrameStats blurGpu;                     // Blur of the VSM/ESM moments
+        int        gpuDropped;                  // Frames the GPU timer lost, 0 when it keeps up
+        double     shadowMapMB;                 // Video memory of the shadow target
+        double     fps;
+        int        shadowCacheHits, shadowCacheMisses;
+        double     shadowVisible, litVisible;   // Objects drawn per pass, mean over the frames that drew it
+        double     shadowTriangles, litTriangles;    // Likewise
+        double     glStateCalls, glStateRedundant;   // Tracked state calls per frame
+        double     queuePackets[2], queueSwitches[2], queueDraws[2];   // Per pass and frame that drew it
+        GlCallStats::Frame glCalls;             // Mean per frame, GL_CALL_STATS builds only
+        int        streamStalls;                // Frames that waited on a stream buffer fence
+        double     streamStallMs;
+    };
+
+    // Programs and VAOs named by the render queue keys, in draw order
+    enum DrawProgram {
+        PROGRAM_LIT, PROGRAM_DEPTH, PROGRAM_CASCADE,
+        PROGRAM_TESS, PROGRAM_TESS_DEPTH, PROGRAM_TESS_CASCADE
+    };
+    enum DrawVao { VAO_LIT, VAO_DEPTH, VAO_PATCHES };
+
+    // Generated arrays of one level of a LOD chain
+    struct MeshArrays {
+        float        *v, *n, *tc;
+        int           nVerts;
+        unsigned int *el;
+        int           nIndices;
+    };
+
+    BenchResult measure(int frames, int warmupFrames);
+    void printBenchResult(const QString &label, const BenchResult &result);
+
     void initialize();
     void setupFBO();
+    void blurShadowMap();
     void modCurTime();
+    void countWakeup();
+    void reportFrameLoop();
 
     void initShaders();
     void CreateVertexBuffer();    
+    void optimizeIndices(unsigned int *el, int nIndices, const float *v, int nVerts);
+    QString meshCacheKey(const QString &generator) const;
+    QVector<PackedMesh> packLodChain(const QVector<MeshArrays> &levels, QVector3D &center, QVector3D &extent);
+    QVector<MeshRange>  addLodChain(const char *name, const QVector<PackedMesh> &meshes);
     void initMatrices();
-    void drawscene();
+    void initScene();
+    void initUniformBuffers();
+    void addStressObjects(int count, bool random, const Material &base);
+    void indexObjects();
+    void selectLods(int pass, const QMatrix4x4 &viewProj, float viewportHeight);
+    void prepareDraws(int pass);
+    void updateObjectBuffer();
+    void uploadUniforms(int pass);
+    void drawscene(int pass);
+    void useDrawProgram(int pass, int program);
+    void updateCascades(const QVector3D &cameraPos, const QVector3D &cameraTarget, float aspect);
+    void setModelMatrix(int index, const QMatrix4x4 &model);
+    void drawObject(const char *name, const DrawElementsIndirectCommand &cmd);
+    void drawPatches(int pass, const RenderQueue::Batch &batch);
     void renderScene();
 
+    QSurface *surface();
+    GLuint    defaultFramebuffer() const;
+
     void PrepareTexture(GLenum TextureTarget, const QString& FileName, GLuint& TexObject, bool flip);
 
 protected:
     void resizeEvent(QResizeEvent *);
+    void exposeEvent(QExposeEvent *);
+    bool event(QEvent *event);
 
 private:
     QOpenGLContext *mContext;
-    QOpenGLFunctions_4_3_Core *mFuncs;
+    GlCoreFunctions *mFuncs;
 
-    QOpenGLShaderProgram *mProgram;
+    bool mHeadless;
+    RenderOptions mOptions;
+    GpuTimer *mGpuTimer;
+    const char *mPassName;
+    QOffscreenSurface        *mOffscreenSurface;
+    QOpenGLFramebufferObject *mOffscreenFBO;
 
-    QTimer mRepaintTimer;
-    double currentTimeMs;
+    QOpenGLShaderProgram *mProgram;
+    QOpenGLShaderProgram *mDepthProgram;
+    QOpenGLShaderProgram *mCascadeProgram;
+    QOpenGLShaderProgram *mTessProgram;         // GPU tessellated teapots, one per program above
+    QOpenGLShaderProgram *mTessDepthProgram;
+    QOpenGLShaderProgram *mTessCascadeProgram;
+    QOpenGLShaderProgram *mBlurProgram;         // Compute blur of the VSM/ESM moments
+    ProgramCache         *mProgramCache;
+
+    // Animation time comes from the monotonic clock, frames from update
+    // requests paced by the swap interval. The timer loop is the old 1 ms
+    // tick counter with a 16 ms repaint timer, kept for comparison.
+    QElapsedTimer mClock;
+    bool   mTimerLoop;
+    double currentTimeMs;               // Tick count of the timer loop
     double currentTimeS;
+    FrameStats mFrameIntervals;         // ms between presented frames
+    qint64 mLastFrameNs, mLastReportNs;
+    int    mWakeups;                    // Timer or update request events since the last report
     bool   mUpdateSize;
+    bool   mUpdateShadowMap;            // The shadow map size or format changed since the last frame
     float  tPrev, angle;
     int    shadowMapWidth, shadowMapHeight;
+    qint64 shadowPassNs, litPassNs;     // CPU time spent issuing each pass of the last frame
+
+    // The shadow map is only re-rendered when the light, a model matrix or
+    // the shadow map itself changed since it was last drawn
+    bool         mShadowDirty;
+    unsigned int mShadowLightVersion;
+    int          mShadowCacheHits, mShadowCacheMisses;
 
-    GLuint mVAOTeapot, mVAOPlane, mVAOTorus, mVBO, mIBO, shadowFBO;
+    bool mObjectsDirty;                     // A model matrix changed since the last object upload
+
+    GLuint mVBO, mIBO;
     GLuint mPositionBufferHandle, mColorBufferHandle;
     GLuint mRotationMatrixLocation;
-    GLuint pass1Index, pass2Index;
-
-    Teapot   *mTeapot;
-    VBOPlane *mPlane;
-    Torus    *mTorus;
+    GLuint pass1Index, pass2Index, tessPass2Index;
+    GLuint mObjectSSBO;
+    ShadowMapTarget *mShadowTarget;         // Depth (and VSM/ESM moments) of the shadow pass
+    GLint  mUniformAlign;
+    GLint  mFrameStride;                    // Block size rounded up to the UBO offset alignment
+    StreamBuffer *mStream;                  // Frame blocks, draw index lists and commands of every frame
+    GLintptr mDrawIndexOffset[2], mIndirectOffset[2];   // Where this frame's lists of each pass went
+    GlState  *mState;                       // Binds and enables of the frame loop, minus the redundant ones
+    FrameCapture *mCapture;                 // Records the frames to disk, 0 when off
+    QByteArray mObjectData;                 // Staging copy of the ObjectUniforms of every object
+    RenderQueue           mQueue[2];        // Draw packets of each pass, rebuilt every frame
+    QVector<MeshRange>    mMeshTable;       // Every level of every LOD chain, the meshes of the queue keys
+    int                   mDrawCalls[2];
+
+    BoundsArray           mWorldBounds;     // World space box of every object
+    QVector<unsigned char> mVisible;
+    int                   mVisibleCount[2];
+    QVector<unsigned char> mObjectLod[2];   // Level drawn by each object, per pass
+    QVector<int>          mObjectMesh;      // Finest level of each object's LOD chain in the mesh table
+    QVector<int>          mObjectLevels;
+    QVector<int>          mObjectMaterial;  // Material number of the queue keys
+    qint64                mTriangleCount[2];
+    int                   mCascadeFirst, mCascadeCount;  // Cascades drawn by the current shadow pass
+
+    QVector<SceneObject> mObjects;
+
+    PackedMesh mTeapotMesh, mPlaneMesh, mTorusMesh;
+    MeshRange  mTeapotRange, mPlaneRange, mTorusRange;   // Finest level of each chain
+    QVector<MeshRange> mTeapotLods, mPlaneLods, mTorusLods;
+    PatchRange mTeapotPatches;
+    QVector3D  mTeapotCenter, mTeapotExtent, mPlaneCenter, mPlaneExtent, mTorusCenter, mTorusExtent;
+    GeometryArena *mArena;
+    MeshCache     *mMeshCache;      // Keeps the mapped mesh files of the arena alive
 
     QVector3D  worldLight;
     Frustum    *lightFrustum;
     QMatrix4x4 ModelMatrixTeapot, ModelMatrixPlane[3], ModelMatrixTorus, ViewMatrix, ProjectionMatrix;
     QMatrix4x4 shadowBias, LightPV, ViewMatrixLight, ProjectionMatrixLight;
+    QMatrix4x4 CascadeViewProj[MAX_CASCADES];
+    float      CascadeSplits[MAX_CASCADES];
 
     //debug
     void printMatrix(const QMatrix4x4& mat);
@@ -1,4 +1,4 @@
-QT += gui core
+QT += gui core concurrent
 
 CONFIG += c++11
 
@@ -8,12 +8,33 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
+# qmake CONFIG+=glstats counts the GL calls of every frame, see glcallstats.h
+glstats: DEFINES += GL_CALL_STATS
+
 SOURCES += main.cpp \
     ShadowMap.cpp \
     teapot.cpp \
     vboplane.cpp \
     torus.cpp \
-    frustum.cpp
+    frustum.cpp \
+    framestats.cpp \
+    gputimer.cpp \
+    shaderbuilder.cpp \
+    geometryarena.cpp \
+    packedmesh.cpp \
+    meshoptimizer.cpp \
+    cachereport.cpp \
+    boundsculler.cpp \
+    cullbench.cpp \
+    tessbench.cpp \
+    meshcache.cpp \
+    programcache.cpp \
+    streambuffer.cpp \
+    glstate.cpp \
+    renderqueue.cpp \
+    glcallstats.cpp \
+    framecapture.cpp \
+    shadowmaptarget.cpp
 
 HEADERS += \
     ShadowMap.h \
@@ -21,15 +42,53 @@ HEADERS += \
     teapot.h \
     vboplane.h \
     torus.h \
-    frustum.h
+    frustum.h \
+    framestats.h \
+    gputimer.h \
+    uniformblocks.h \
+    renderoptions.h \
+    shaderbuilder.h \
+    geometryarena.h \
+    packedmesh.h \
+    meshoptimizer.h \
+    cachereport.h \
+    boundsculler.h \
+    cullbench.h \
+    tessbench.h \
+    meshcache.h \
+    programcache.h \
+    streambuffer.h \
+    glstate.h \
+    renderqueue.h \
+    glcallstats.h \
+    framecapture.h \
+    shadowmaptarget.h
 
 OTHER_FILES += \
     fshader.txt \
-    vshader.txt
+    vshader.txt \
+    depthvshader.txt \
+    uniformblocks.txt \
+    cascadevshader.txt \
+    cascadegshader.txt \
+    patchvshader.txt \
+    patchtcshader.txt \
+    patchteshader.txt \
+    momentsfshader.txt \
+    blurcshader.txt
 
 RESOURCES += \
     shaders.qrc
 
 DISTFILES += \
     fshader.txt \
-    vshader.txt
+    vshader.txt \
+    depthvshader.txt \
+    uniformblocks.txt \
+    cascadevshader.txt \
+    cascadegshader.txt \
+    patchvshader.txt \
+    patchtcshader.txt \
+    patchteshader.txt \
+    momentsfshader.txt \
+    blurcshader.txt
@@ -0,0 +1,204 @@
+#include "boundsculler.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULL_SSE
+#endif
+
+void BoundsArray::resize(int count)
+{
+    cx.resize(count); cy.resize(count); cz.resize(count);
+    ex.resize(count); ey.resize(count); ez.resize(count);
+}
+
+int BoundsArray::size() const
+{
+    return cx.size();
+}
+
+void BoundsArray::set(int i, const QVector3D &center, const QVector3D &extent)
+{
+    cx[i] = center.x(); cy[i] = center.y(); cz[i] = center.z();
+    ex[i] = extent.x(); ey[i] = extent.y(); ez[i] = extent.z();
+}
+
+void BoundsCuller::computeBounds(const float *v, int nVerts, QVector3D &center, QVector3D &extent)
+{
+    if (nVerts <= 0) {
+        center = extent = QVector3D();
+        return;
+    }
+
+    QVector3D lo(v[0], v[1], v[2]), hi = lo;
+    for (int i = 1; i < nVerts; i++)
+    {
+        QVector3D p(v[3 * i], v[3 * i + 1], v[3 * i + 2]);
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+    }
+
+    center = 0.5f * (lo + hi);
+    extent = 0.5f * (hi - lo);
+}
+
+// Arvo: the new extents are the old ones through the absolute values of
+// the rotation and scale part
+void BoundsCuller::transformBounds(const QMatrix4x4 &m, const QVector3D &center, const QVector3D &extent,
+                                   QVector3D &outCenter, QVector3D &outExtent)
+{
+    outCenter = m * center;
+
+    float e[3];
+    for (int r = 0; r < 3; r++)
+        e[r] = fabsf(m(r, 0)) * extent.x() + fabsf(m(r, 1)) * extent.y() + fabsf(m(r, 2)) * extent.z();
+    outExtent = QVector3D(e[0], e[1], e[2]);
+}
+
+// A box is outside when it is entirely behind one of the planes
+static inline bool boxVisible(const BoundsArray &b, int i, const QVector4D planes[6])
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const QVector4D &pl = planes[p];
+        float dist = pl.x() * b.cx[i] + pl.y() * b.cy[i] + pl.z() * b.cz[i] + pl.w();
+        float radius = fabsf(pl.x()) * b.ex[i] + fabsf(pl.y()) * b.ey[i] + fabsf(pl.z()) * b.ez[i];
+        if (dist + radius < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+int BoundsCuller::cullScalar(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible)
+{
+    int count = 0;
+    for (int i = 0; i < bounds.size(); i++) {
+        visible[i] = boxVisible(bounds, i, planes) ? 1 : 0;
+        count += visible[i];
+    }
+    return count;
+}
+
+#if defined(CULL_AVX)
+
+int BoundsCuller::cull(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible)
+{
+    const float *cx = bounds.cx.constData(), *cy = bounds.cy.constData(), *cz = bounds.cz.constData();
+    const float *ex = bounds.ex.constData(), *ey = bounds.ey.constData(), *ez = bounds.ez.constData();
+
+    __m256 n[6][3], absN[6][3], d[6];
+    for (int p = 0; p < 6; p++)
+        for (int c = 0; c < 3; c++) {
+            n[p][c] = _mm256_set1_ps(planes[p][c]);
+            absN[p][c] = _mm256_set1_ps(fabsf(planes[p][c]));
+            d[p] = _mm256_set1_ps(planes[p].w());
+        }
+    const __m256 zero = _mm256_setzero_ps();
+
+    int count = 0;
+    int i = 0;
+    for (; i + 8 <= bounds.size(); i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(cx + i), y = _mm256_loadu_ps(cy + i), z = _mm256_loadu_ps(cz + i);
+        __m256 rx = _mm256_loadu_ps(ex + i), ry = _mm256_loadu_ps(ey + i), rz = _mm256_loadu_ps(ez + i);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[p][0], x), _mm256_mul_ps(n[p][1], y)),
+                                        _mm256_add_ps(_mm256_mul_ps(n[p][2], z), d[p]));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absN[p][0], rx), _mm256_mul_ps(absN[p][1], ry)),
+                                          _mm256_mul_ps(absN[p][2], rz));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, radius), zero, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++) {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+
+    for (; i < bounds.size(); i++) {
+        visible[i] = boxVisible(bounds, i, planes) ? 1 : 0;
+        count += visible[i];
+    }
+
+    return count;
+}
+
+const char *BoundsCuller::simdName()
+{
+    return "AVX";
+}
+
+#elif defined(CULL_SSE)
+
+int BoundsCuller::cull(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible)
+{
+    const float *cx = bounds.cx.constData(), *cy = bounds.cy.constData(), *cz = bounds.cz.constData();
+    const float *ex = bounds.ex.constData(), *ey = bounds.ey.constData(), *ez = bounds.ez.constData();
+
+    __m128 n[6][3], absN[6][3], d[6];
+    for (int p = 0; p < 6; p++)
+        for (int c = 0; c < 3; c++) {
+            n[p][c] = _mm_set1_ps(planes[p][c]);
+            absN[p][c] = _mm_set1_ps(fabsf(planes[p][c]));
+            d[p] = _mm_set1_ps(planes[p].w());
+        }
+    const __m128 zero = _mm_setzero_ps();
+
+    int count = 0;
+    int i = 0;
+    for (; i + 4 <= bounds.size(); i += 4)
+    {
+        __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i), z = _mm_loadu_ps(cz + i);
+        __m128 rx = _mm_loadu_ps(ex + i), ry = _mm_loadu_ps(ey + i), rz = _mm_loadu_ps(ez + i);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[p][0], x), _mm_mul_ps(n[p][1], y)),
+                                     _mm_add_ps(_mm_mul_ps(n[p][2], z), d[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absN[p][0], rx), _mm_mul_ps(absN[p][1], ry)),
+                                       _mm_mul_ps(absN[p][2], rz));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++) {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+
+    for (; i < bounds.size(); i++) {
+        visible[i] = boxVisible(bounds, i, planes) ? 1 : 0;
+        count += visible[i];
+    }
+
+    return count;
+}
+
+const char *BoundsCuller::simdName()
+{
+    return "SSE2";
+}
+
+#else
+
+int BoundsCuller::cull(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible)
+{
+    return cullScalar(bounds, planes, visible);
+}
+
+const char *BoundsCuller::simdName()
+{
+    return "none";
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef BOUNDSCULLER_H
+#define BOUNDSCULLER_H
+
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+#include <QMatrix4x4>
+
+// Axis aligned boxes as center and half extents, one array per component
+// so the kernels load several boxes per instruction
+struct BoundsArray
+{
+    QVector<float> cx, cy, cz;
+    QVector<float> ex, ey, ez;
+
+    void resize(int count);
+    int  size() const;
+    void set(int i, const QVector3D &center, const QVector3D &extent);
+};
+
+// Frustum culling of many boxes against six planes at once. cull() uses
+// the widest SIMD path the build allows (AVX, SSE2) and cullScalar() is
+// the plain reference version. Both write 1 or 0 per box to visible and
+// return the number of visible boxes.
+class BoundsCuller
+{
+public:
+    // Tight box around a vertex array
+    static void computeBounds(const float *v, int nVerts, QVector3D &center, QVector3D &extent);
+    // Box of a transformed box, still tight for the axes of the transform
+    static void transformBounds(const QMatrix4x4 &m, const QVector3D &center, const QVector3D &extent,
+                                QVector3D &outCenter, QVector3D &outExtent);
+
+    static int cull(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible);
+    static int cullScalar(const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible);
+
+    static const char *simdName();
+};
+
+#endif // BOUNDSCULLER_H
@@ -0,0 +1,56 @@
+#include "cachereport.h"
+
+#include "meshoptimizer.h"
+#include "teapot.h"
+#include "torus.h"
+#include "vboplane.h"
+
+#include <cstdio>
+#include <cstring>
+
+static void printStats(const char *order, const unsigned int *el, int nIndices, int nVerts, int cacheSize)
+{
+    MeshOptimizer::CacheStats fifo = MeshOptimizer::simulateCache(el, nIndices, nVerts, cacheSize, MeshOptimizer::FIFO);
+    MeshOptimizer::CacheStats lru  = MeshOptimizer::simulateCache(el, nIndices, nVerts, cacheSize, MeshOptimizer::LRU);
+
+    printf("  %-10s FIFO ACMR %.3f ATVR %.3f   LRU ACMR %.3f ATVR %.3f\n",
+           order, fifo.acmr(), fifo.atvr(), lru.acmr(), lru.atvr());
+}
+
+static void reportMesh(const char *name, int grid, const unsigned int *el, int nIndices, const float *v, int nVerts, int cacheSize)
+{
+    printf("%s, grid %d: %d verts, %d triangles\n", name, grid, nVerts, nIndices / 3);
+
+    QVector<unsigned int> indices(nIndices);
+    memcpy(indices.data(), el, nIndices * sizeof(unsigned int));
+    printStats("input", indices.constData(), nIndices, nVerts, cacheSize);
+
+    QVector<int> clusters = MeshOptimizer::optimizeVertexCache(indices.data(), nIndices, nVerts, cacheSize);
+    printStats("tipsify", indices.constData(), nIndices, nVerts, cacheSize);
+
+    MeshOptimizer::optimizeOverdraw(indices.data(), nIndices, v, clusters);
+    printStats("+overdraw", indices.constData(), nIndices, nVerts, cacheSize);
+    printf("  %d clusters\n", clusters.size());
+}
+
+int runVertexCacheReport(const QList<int> &grids, int cacheSize)
+{
+    printf("Post-transform vertex cache, %d entries\n", cacheSize);
+
+    for (int i = 0; i < grids.size(); i++)
+    {
+        int grid = grids[i];
+
+        QMatrix4x4 transform;
+        Teapot teapot(grid, transform);
+        reportMesh("teapot", grid, teapot.getelems(), 6 * teapot.getnFaces(), teapot.getv(), teapot.getnVerts(), cacheSize);
+
+        Torus torus(0.7f * 2.0f, 0.3f * 2.0f, grid, grid);
+        reportMesh("torus", grid, torus.getel(), 6 * torus.getnFaces(), torus.getv(), torus.getnVerts(), cacheSize);
+
+        VBOPlane plane(40.0f, 40.0f, grid, grid);
+        reportMesh("plane", grid, plane.getelems(), 6 * plane.getnFaces(), plane.getv(), plane.getnVerts(), cacheSize);
+    }
+
+    return 0;
+}
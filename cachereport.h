@@ -0,0 +1,11 @@
+#ifndef CACHEREPORT_H
+#define CACHEREPORT_H
+
+#include <QList>
+
+// Simulates the post-transform vertex cache on the generated meshes at
+// several tessellations and prints ACMR/ATVR for FIFO and LRU caches, in
+// input order and after MeshOptimizer. Runs on the CPU only.
+int runVertexCacheReport(const QList<int> &grids, int cacheSize);
+
+#endif // CACHEREPORT_H
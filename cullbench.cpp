@@ -0,0 +1,68 @@
+#include "cullbench.h"
+
+#include "boundsculler.h"
+#include "frustum.h"
+
+#include <QElapsedTimer>
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Best of several rounds, each long enough to be above the timer noise
+static double objectsPerMs(int (*kernel)(const BoundsArray &, const QVector4D *, unsigned char *),
+                           const BoundsArray &bounds, const QVector4D planes[6], unsigned char *visible, int &nVisible)
+{
+    int repeats = qMax(1, 20000000 / qMax(1, bounds.size()));
+    double best = 0.0;
+
+    for (int round = 0; round < 5; round++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for (int r = 0; r < repeats; r++)
+            nVisible = kernel(bounds, planes, visible);
+        double ms = timer.nsecsElapsed() / 1.0e6;
+        best = qMax(best, (double)bounds.size() * repeats / ms);
+    }
+
+    return best;
+}
+
+int runCullingBenchmark(const QList<int> &counts)
+{
+    // A camera in the middle of a cloud of boxes, roughly a tenth visible
+    Frustum camera(Projection::PERSPECTIVE);
+    camera.orient(QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    camera.setPerspective(50.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+    QVector4D planes[6];
+    camera.getPlanes(planes);
+
+    printf("Frustum culling, SIMD path: %s\n", BoundsCuller::simdName());
+    printf("%9s %9s %16s %16s %8s\n", "objects", "visible", "scalar (obj/ms)", "SIMD (obj/ms)", "speedup");
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+
+    for (int c = 0; c < counts.size(); c++)
+    {
+        int count = counts[c];
+
+        BoundsArray bounds;
+        bounds.resize(count);
+        for (int i = 0; i < count; i++)
+            bounds.set(i, QVector3D(position(rng), position(rng), position(rng)), QVector3D(size(rng), size(rng), size(rng)));
+
+        QVector<unsigned char> scalarVisible(count), simdVisible(count);
+        int nScalar = 0, nSimd = 0;
+        double scalar = objectsPerMs(BoundsCuller::cullScalar, bounds, planes, scalarVisible.data(), nScalar);
+        double simd = objectsPerMs(BoundsCuller::cull, bounds, planes, simdVisible.data(), nSimd);
+
+        printf("%9d %9d %16.0f %16.0f %7.2fx\n", count, nSimd, scalar, simd, simd / scalar);
+        if (nScalar != nSimd || memcmp(scalarVisible.constData(), simdVisible.constData(), count) != 0)
+            printf("  Warning: the SIMD and scalar kernels disagree\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef CULLBENCH_H
+#define CULLBENCH_H
+
+#include <QList>
+
+// Culling throughput of the scalar and SIMD kernels of BoundsCuller on
+// random boxes, in objects per millisecond. Runs on the CPU only.
+int runCullingBenchmark(const QList<int> &counts);
+
+#endif // CULLBENCH_H
@@ -0,0 +1,382 @@
+#include "framecapture.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+// Frames the writer may have queued before new ones are dropped
+static const int MAX_BACKLOG = 8;
+
+struct CaptureFrame
+{
+    QByteArray pixels;          // RGBA, bottom row first as GL reads it
+    int        width, height;
+};
+
+// Writes the captured frames on its own thread, so the file system never
+// holds up the frame loop
+class CaptureWriter : public QThread
+{
+public:
+    CaptureWriter(const QString &fileName, FrameCapture::Format format, double fps);
+
+    bool isOpen() const;
+    int  backlog();
+    void push(const CaptureFrame &frame);
+    // Writes what is still queued, then ends the thread
+    void stop();
+
+    int    getWritten() const;
+    qint64 getBytes() const;
+
+protected:
+    void run() override;
+
+private:
+    QFile file;
+    FrameCapture::Format format;
+    double fps;
+    QMutex mutex;
+    QWaitCondition wake;
+    QList<CaptureFrame> queue;
+    bool stopping;
+    bool headerWritten;
+    int  written;
+    qint64 bytes;
+    QByteArray planes;          // Y4M conversion buffer
+
+    void write(const CaptureFrame &frame);
+};
+
+CaptureWriter::CaptureWriter(const QString &fileName, FrameCapture::Format format, double fps)
+    : file(fileName), format(format), fps(fps), stopping(false), headerWritten(false), written(0), bytes(0)
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        qWarning() << "FrameCapture: cannot write" << fileName;
+}
+
+bool CaptureWriter::isOpen() const
+{
+    return file.isOpen();
+}
+
+int CaptureWriter::backlog()
+{
+    QMutexLocker lock(&mutex);
+    return queue.size();
+}
+
+void CaptureWriter::push(const CaptureFrame &frame)
+{
+    QMutexLocker lock(&mutex);
+    queue.append(frame);
+    wake.wakeOne();
+}
+
+void CaptureWriter::stop()
+{
+    mutex.lock();
+    stopping = true;
+    wake.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void CaptureWriter::run()
+{
+    for (;;)
+    {
+        mutex.lock();
+        while (queue.isEmpty() && !stopping)
+            wake.wait(&mutex);
+        if (queue.isEmpty()) {
+            mutex.unlock();
+            break;
+        }
+        CaptureFrame frame = queue.takeFirst();
+        mutex.unlock();
+
+        write(frame);
+    }
+    file.close();
+}
+
+// Raw frames are the RGBA rows top first. Y4M frames are 4:2:0 with JPEG
+// (full range BT.601) chroma, cropped to even dimensions.
+void CaptureWriter::write(const CaptureFrame &frame)
+{
+    int w = frame.width, h = frame.height;
+    const uchar *rgba = (const uchar *)frame.pixels.constData();
+
+    if (format == FrameCapture::RAW_RGBA) {
+        for (int y = h - 1; y >= 0; y--)
+            bytes += file.write((const char *)rgba + y * w * 4, w * 4);
+        written++;
+        return;
+    }
+
+    w &= ~1;
+    h &= ~1;
+    if (!headerWritten) {
+        // The rate in thousandths, so 62.5 Hz timer frames are exact
+        bytes += file.write(QString("YUV4MPEG2 W%1 H%2 F%3:1000 Ip A1:1 C420jpeg\n")
+                            .arg(w).arg(h).arg(qRound(fps * 1000.0)).toLatin1());
+        headerWritten = true;
+    }
+
+    int cw = w / 2, ch = h / 2;
+    planes.resize(w * h + 2 * cw * ch);
+    uchar *yPlane = (uchar *)planes.data();
+    uchar *uPlane = yPlane + w * h;
+    uchar *vPlane = uPlane + cw * ch;
+
+    for (int y = 0; y < h; y++)
+    {
+        const uchar *row = rgba + (frame.height - 1 - y) * frame.width * 4;
+        for (int x = 0; x < w; x++)
+            yPlane[y * w + x] = (uchar)((77 * row[4 * x] + 150 * row[4 * x + 1] + 29 * row[4 * x + 2] + 128) >> 8);
+    }
+
+    // Chroma from the mean of each 2x2 block
+    for (int y = 0; y < ch; y++)
+    {
+        const uchar *row0 = rgba + (frame.height - 1 - 2 * y) * frame.width * 4;
+        const uchar *row1 = row0 - frame.width * 4;
+        for (int x = 0; x < cw; x++)
+        {
+            int r = row0[8 * x] + row0[8 * x + 4] + row1[8 * x] + row1[8 * x + 4];
+            int g = row0[8 * x + 1] + row0[8 * x + 5] + row1[8 * x + 1] + row1[8 * x + 5];
+            int b = row0[8 * x + 2] + row0[8 * x + 6] + row1[8 * x + 2] + row1[8 * x + 6];
+            int u = (-43 * r - 85 * g + 128 * b + 512) / 1024 + 128;
+            int v = (128 * r - 107 * g - 21 * b + 512) / 1024 + 128;
+            uPlane[y * cw + x] = (uchar)qBound(0, u, 255);
+            vPlane[y * cw + x] = (uchar)qBound(0, v, 255);
+        }
+    }
+
+    bytes += file.write("FRAME\n", 6);
+    bytes += file.write(planes.constData(), planes.size());
+    written++;
+}
+
+int CaptureWriter::getWritten() const
+{
+    return written;
+}
+
+qint64 CaptureWriter::getBytes() const
+{
+    return bytes;
+}
+
+FrameCapture::FrameCapture(GlCoreFunctions *funcs, const QString &fileName, Format format, double fps, int ringSize)
+    : mFuncs(funcs), next(0), frameCount(0), captured(0), droppedRing(0), droppedWriter(0), droppedSize(0),
+      droppedTimeout(0), droppedError(0), width(0), height(0), checked(false), failed(false), resolveFbo(0), resolveRbo(0)
+{
+    Slot empty = { 0, 0, 0, 0, 0, 0, 0 };
+    ring.fill(empty, qMax(2, ringSize));
+
+    writer = new CaptureWriter(fileName, format, fps);
+    if (writer->isOpen())
+        writer->start();
+    clock.start();
+}
+
+FrameCapture::~FrameCapture()
+{
+    collect(true);
+    for (int i = 0; i < ring.size(); i++)
+        mFuncs->glDeleteBuffers(1, &ring[i].pbo);
+    if (resolveFbo != 0) mFuncs->glDeleteFramebuffers(1, &resolveFbo);
+    if (resolveRbo != 0) mFuncs->glDeleteRenderbuffers(1, &resolveRbo);
+
+    if (writer->isOpen())
+        writer->stop();
+    printSummary();
+    delete writer;
+}
+
+bool FrameCapture::isOpen() const
+{
+    return writer->isOpen();
+}
+
+void FrameCapture::capture(GLuint framebuffer, int w, int h, int samples)
+{
+    frameCount++;
+    if (!writer->isOpen())
+        return;
+    if (failed) {
+        droppedError++;
+        return;
+    }
+
+    collect(false);
+
+    if (width == 0) {
+        width = w;
+        height = h;
+    }
+    if (w != width || h != height) {
+        if (droppedSize++ == 0)
+            qWarning() << "FrameCapture: the window size changed, frames of another size are not recorded";
+        return;
+    }
+
+    // Waiting on either would stall the frame loop
+    Slot &slot = ring[next];
+    if (slot.fence != 0) {
+        droppedRing++;
+        return;
+    }
+    if (writer->backlog() >= MAX_BACKLOG) {
+        droppedWriter++;
+        return;
+    }
+
+    GLsizeiptr size = (GLsizeiptr)w * h * 4;
+    if (slot.pbo == 0)
+        mFuncs->glGenBuffers(1, &slot.pbo);
+    mFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (slot.size != size) {
+        mFuncs->glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot.size = size;
+    }
+
+    // Errors the renderer left behind are not the readback's
+    if (!checked)
+        for (int i = 0; i < 16 && mFuncs->glGetError() != GL_NO_ERROR; i++) {}
+
+    // glReadPixels cannot read a multisampled framebuffer object. The copy
+    // runs on the GPU, the pack buffer is only mapped once it is done.
+    GLuint source = samples > 0 && framebuffer != 0 ? resolve(framebuffer, w, h) : framebuffer;
+    mFuncs->glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+    mFuncs->glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    mFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (source != framebuffer)
+        mFuncs->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    // A readback that fails once fails every frame, and would write garbage
+    if (!checked) {
+        checked = true;
+        GLenum error = mFuncs->glGetError();
+        if (error != GL_NO_ERROR) {
+            qWarning("FrameCapture: the readback failed with GL error 0x%x, nothing is recorded", error);
+            failed = true;
+            droppedError++;
+            return;
+        }
+    }
+
+    slot.fence = mFuncs->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = w;
+    slot.height = h;
+    slot.frame = frameCount;
+    slot.issuedNs = clock.nsecsElapsed();
+
+    next = (next + 1) % ring.size();
+}
+
+// Hands the finished readbacks to the writer, oldest first. Stops at the
+// first one still in flight, so frames stay in order.
+void FrameCapture::collect(bool wait)
+{
+    for (int n = 0; n < ring.size(); n++)
+    {
+        Slot &slot = ring[(next + n) % ring.size()];
+        if (slot.fence == 0)
+            continue;
+
+        GLenum status = mFuncs->glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                                 wait ? 1000000000 : 0);
+        if (status == GL_TIMEOUT_EXPIRED && !wait)
+            break;
+        mFuncs->glDeleteSync(slot.fence);
+        slot.fence = 0;
+        // Still not done after waiting, at shutdown: the frame is lost
+        if (status == GL_TIMEOUT_EXPIRED) {
+            droppedTimeout++;
+            continue;
+        }
+        if (status == GL_WAIT_FAILED) {
+            qWarning() << "FrameCapture: glClientWaitSync failed";
+            continue;
+        }
+
+        CaptureFrame frame;
+        frame.width = slot.width;
+        frame.height = slot.height;
+        mFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const void *src = mFuncs->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+        if (src != 0) {
+            frame.pixels = QByteArray((const char *)src, slot.size);
+            mFuncs->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        mFuncs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (frame.pixels.isEmpty())
+            continue;
+
+        latencyMs.add((clock.nsecsElapsed() - slot.issuedNs) / 1.0e6);
+        latencyFrames.add(frameCount - slot.frame);
+        writer->push(frame);
+        captured++;
+    }
+}
+
+// Copies the color of a multisampled framebuffer into the single sample
+// renderbuffer, made on first use. The size never changes once recording.
+GLuint FrameCapture::resolve(GLuint framebuffer, int w, int h)
+{
+    if (resolveFbo == 0) {
+        mFuncs->glGenRenderbuffers(1, &resolveRbo);
+        mFuncs->glBindRenderbuffer(GL_RENDERBUFFER, resolveRbo);
+        mFuncs->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        mFuncs->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        mFuncs->glGenFramebuffers(1, &resolveFbo);
+        mFuncs->glBindFramebuffer(GL_FRAMEBUFFER, resolveFbo);
+        mFuncs->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveRbo);
+        if (mFuncs->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            qWarning() << "FrameCapture: the resolve framebuffer is not complete";
+    }
+
+    mFuncs->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    mFuncs->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFbo);
+    mFuncs->glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    return resolveFbo;
+}
+
+int FrameCapture::getCaptured() const
+{
+    return captured;
+}
+
+int FrameCapture::getDropped() const
+{
+    return droppedRing + droppedWriter + droppedSize + droppedTimeout + droppedError;
+}
+
+const FrameStats &FrameCapture::getLatencyMs() const
+{
+    return latencyMs;
+}
+
+const FrameStats &FrameCapture::getLatencyFrames() const
+{
+    return latencyFrames;
+}
+
+void FrameCapture::printSummary() const
+{
+    printf("Frame capture: %d of %lld frames read back, %d written (%.1f MB), %d dropped (%d ring busy, %d writer behind,"
+           " %d resized, %d unfinished at exit, %d readback failed)\n",
+           captured, (long long)frameCount, writer->getWritten(), writer->getBytes() / 1048576.0, getDropped(),
+           droppedRing, droppedWriter, droppedSize, droppedTimeout, droppedError);
+    if (latencyMs.count() > 0)
+        printf("  Readback latency: mean %.2f ms, p99 %.2f ms, mean %.1f frames\n",
+               latencyMs.mean(), latencyMs.percentile(99.0), latencyFrames.mean());
+}
@@ -0,0 +1,76 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include "glcallstats.h"
+#include "framestats.h"
+
+class CaptureWriter;
+
+// Records the rendered frames to a file without stalling the frame loop.
+//
+// Each frame is read back into the next of a ring of pixel pack buffers
+// and fenced. The buffers are mapped a few frames later, once their fence
+// has signaled, and the pixels go to a writer thread that streams them as
+// raw RGBA rows (top row first) or as a Y4M video. A frame is dropped
+// rather than waited for when its ring slot is still in flight or the
+// writer is too far behind.
+//
+// A multisampled framebuffer cannot be read directly, it is first
+// resolved into a single sample renderbuffer owned by the capture. The
+// Y4M header carries the rate the frame loop is paced at, which is only
+// nominal when the loop is not throttled.
+class FrameCapture
+{
+public:
+    enum Format { RAW_RGBA, Y4M };
+
+    FrameCapture(GlCoreFunctions *funcs, const QString &fileName, Format format, double fps, int ringSize = 3);
+    // Collects the frames in flight and waits for the writer. Frames
+    // whose readback still has not finished are counted as dropped.
+    ~FrameCapture();
+
+    bool isOpen() const;
+
+    // Queues a readback of the framebuffer, before the buffer swap.
+    // samples is that of the framebuffer, 0 when it is single sampled.
+    void capture(GLuint framebuffer, int width, int height, int samples = 0);
+
+    int getCaptured() const;
+    int getDropped() const;
+    // ms and frames from the readback to the pixels reaching the CPU
+    const FrameStats &getLatencyMs() const;
+    const FrameStats &getLatencyFrames() const;
+    void printSummary() const;
+
+private:
+    struct Slot {
+        GLuint  pbo;
+        GLsizeiptr size;
+        GLsync  fence;
+        int     width, height;
+        qint64  frame;
+        qint64  issuedNs;
+    };
+
+    GlCoreFunctions *mFuncs;
+    CaptureWriter *writer;
+    QVector<Slot> ring;
+    int    next;
+    qint64 frameCount;
+    int    captured, droppedRing, droppedWriter, droppedSize, droppedTimeout, droppedError;
+    int    width, height;           // Of the first frame, the file keeps them
+    bool   checked;                 // The first readback was checked for GL errors
+    bool   failed;                  // And raised one, nothing is read back any more
+    GLuint resolveFbo, resolveRbo;  // Single sample copy of a multisampled source
+    QElapsedTimer clock;
+    FrameStats latencyMs, latencyFrames;
+
+    void collect(bool wait);
+    GLuint resolve(GLuint framebuffer, int w, int h);
+};
+
+#endif // FRAMECAPTURE_H
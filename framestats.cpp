@@ -0,0 +1,101 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <cmath>
+
+FrameStats::FrameStats(int capacity) : capacity(capacity), next(0)
+{
+    if (capacity > 0)
+        samples.reserve(capacity);
+}
+
+void FrameStats::add(double ms)
+{
+    if (capacity > 0 && samples.size() == capacity) {
+        samples[next] = ms;
+        next = (next + 1) % capacity;
+    } else {
+        samples.append(ms);
+    }
+}
+
+void FrameStats::clear()
+{
+    samples.clear();
+    next = 0;
+}
+
+int FrameStats::count() const
+{
+    return samples.size();
+}
+
+double FrameStats::last() const
+{
+    if (samples.isEmpty())
+        return 0.0;
+    if (capacity > 0 && samples.size() == capacity)
+        return samples[(next + capacity - 1) % capacity];
+    return samples.last();
+}
+
+double FrameStats::mean() const
+{
+    if (samples.isEmpty())
+        return 0.0;
+    return sum() / samples.size();
+}
+
+double FrameStats::min() const
+{
+    if (samples.isEmpty())
+        return 0.0;
+    return *std::min_element(samples.constBegin(), samples.constEnd());
+}
+
+double FrameStats::max() const
+{
+    if (samples.isEmpty())
+        return 0.0;
+    return *std::max_element(samples.constBegin(), samples.constEnd());
+}
+
+double FrameStats::sum() const
+{
+    double total = 0.0;
+    for (int i = 0; i < samples.size(); i++)
+        total += samples[i];
+    return total;
+}
+
+// Population standard deviation, the jitter of frame intervals
+double FrameStats::stddev() const
+{
+    if (samples.isEmpty())
+        return 0.0;
+
+    double m = mean();
+    double total = 0.0;
+    for (int i = 0; i < samples.size(); i++)
+        total += (samples[i] - m) * (samples[i] - m);
+    return std::sqrt(total / samples.size());
+}
+
+// Nearest-rank percentile, p in [0, 100]
+double FrameStats::percentile(double p) const
+{
+    if (samples.isEmpty())
+        return 0.0;
+
+    QVector<double> sorted = samples;
+    int rank = (int)std::ceil(p / 100.0 * sorted.size()) - 1;
+    rank = std::max(0, std::min(rank, sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+
+    return sorted[rank];
+}
+
+const QVector<double> &FrameStats::getSamples() const
+{
+    return samples;
+}
@@ -0,0 +1,34 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <QVector>
+
+// Collects timing samples (in milliseconds) and reports summary statistics.
+// With a non-zero capacity the samples form a rolling window where the
+// oldest sample is overwritten once the window is full.
+class FrameStats
+{
+private:
+    QVector<double> samples;
+    int capacity;
+    int next;
+
+public:
+    explicit FrameStats(int capacity = 0);
+
+    void add(double ms);
+    void clear();
+
+    int    count() const;
+    double last() const;
+    double mean() const;
+    double min() const;
+    double max() const;
+    double sum() const;
+    double stddev() const;
+    double percentile(double p) const;
+
+    const QVector<double> &getSamples() const;
+};
+
+#endif // FRAMESTATS_H
@@ -8,7 +8,7 @@
 
 #include <QtMath>
 
-Frustum::Frustum(Projection::ProjType t) : type(t)
+Frustum::Frustum(Projection::ProjType t) : type(t), version(0)
 {
     //int elem[12 * 2];
 
@@ -49,6 +49,7 @@ void Frustum::orient( const QVector3D &pos, const QVector3D& a, const QVector3D&
     this->origin = pos;
     this->at = a;
     this->up = u;
+    version++;
 }
 
 void Frustum::setOrthoBounds( float xmin, float xmax, float ymin, float ymax,
@@ -60,6 +61,7 @@ void Frustum::setOrthoBounds( float xmin, float xmax, float ymin, float ymax,
     this->ymax= ymax;
     this->mNear = nearDist;
 	this->mFar = farDist;
+    version++;
 }
 
 void Frustum::setPerspective( float fovy, float ar, float nearDist, float farDist )
@@ -68,6 +70,14 @@ void Frustum::setPerspective( float fovy, float ar, float nearDist, float farDis
     this->ar = ar;
     this->mNear = nearDist;
     this->mFar = farDist;
+    version++;
+}
+
+void Frustum::setDepthRange( float nearDist, float farDist )
+{
+    this->mNear = nearDist;
+    this->mFar = farDist;
+    version++;
 }
 
 void Frustum::enclose( const Frustum & other )
@@ -135,7 +145,7 @@ void Frustum::enclose( const Frustum & other )
         ar = w / h;
     } else {
         xmin = ymin = mNear = std::numeric_limits<float>::max();
-        xmax = ymax = mFar = std::numeric_limits<float>::min();
+        xmax = ymax = mFar = -std::numeric_limits<float>::max();
         for( int i = 0; i < 8; i++) {
             // Convert to local space
             QVector4D pt = m * QVector4D(p[i],1.0f);
@@ -148,6 +158,7 @@ void Frustum::enclose( const Frustum & other )
         }
     }
 
+    version++;
 }
 
 QMatrix4x4 Frustum::getViewMatrix() const
@@ -176,6 +187,49 @@ QVector3D Frustum::getOrigin() const
     return this->origin;
 }
 
+unsigned int Frustum::getVersion() const
+{
+    return version;
+}
+
+float Frustum::getNear() const
+{
+    return this->mNear;
+}
+
+float Frustum::getFar() const
+{
+    return this->mFar;
+}
+
+void Frustum::getPlanes( QVector4D planes[6] ) const
+{
+    extractPlanes(getProjectionMatrix() * getViewMatrix(), planes);
+}
+
+// Gribb and Hartmann: each plane is the last row of the matrix plus or
+// minus one of the others
+void Frustum::extractPlanes( const QMatrix4x4 &viewProj, QVector4D planes[6] )
+{
+    QVector4D r0 = viewProj.row(0);
+    QVector4D r1 = viewProj.row(1);
+    QVector4D r2 = viewProj.row(2);
+    QVector4D r3 = viewProj.row(3);
+
+    planes[0] = r3 + r0;
+    planes[1] = r3 - r0;
+    planes[2] = r3 + r1;
+    planes[3] = r3 - r1;
+    planes[4] = r3 + r2;
+    planes[5] = r3 - r2;
+
+    for( int i = 0; i < 6; i++ ) {
+        float len = planes[i].toVector3D().length();
+        if( len > 0.0f )
+            planes[i] /= len;
+    }
+}
+
 QVector3D Frustum::getCenter() const
 {
     float dist = (mNear + mFar) / 2.0f;
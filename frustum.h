@@ -2,6 +2,7 @@
 #define FRUSTUM_H
 
 #include <QVector3D>
+#include <QVector4D>
 #include <QMatrix4x4>
 
 namespace Projection {
@@ -27,6 +28,8 @@ private:
     QVector3D view, proj;
     int       handle[2];
 
+    unsigned int version;   // Bumped whenever the frustum changes
+
 public:
     Frustum( Projection::ProjType type );
 
@@ -34,12 +37,21 @@ public:
     void setOrthoBounds( float xmin, float xmax, float ymin, float ymax,
                          float , float  );
     void setPerspective( float , float , float , float  );
+    void setDepthRange( float , float );
     void enclose( const Frustum & );
 
     QMatrix4x4 getViewMatrix() const;
     QMatrix4x4 getProjectionMatrix() const;
     QVector3D getOrigin() const;
     QVector3D getCenter() const;
+    float getNear() const;
+    float getFar() const;
+    unsigned int getVersion() const;
+
+    // Inward facing planes (a, b, c, d) with unit normals, in the order
+    // left, right, bottom, top, near, far
+    void getPlanes( QVector4D planes[6] ) const;
+    static void extractPlanes( const QMatrix4x4 &viewProj, QVector4D planes[6] );
 
     void printInfo() const;
     void render() const;
@@ -0,0 +1,224 @@
+#include "geometryarena.h"
+
+#include <QDebug>
+
+GeometryArena::GeometryArena(GlCoreFunctions *funcs)
+    : mFuncs(funcs), nVerts(0), nIndices(0),
+      positionBuffer(0), attributeBuffer(0), indexBuffer(0), drawIndexBuffer(0), patchBuffer(0),
+      litVao(0), depthVao(0), patchVao(0), indexType(GL_UNSIGNED_SHORT), drawCapacity(0)
+{
+}
+
+GeometryArena::~GeometryArena()
+{
+    GLuint buffers[] = { positionBuffer, attributeBuffer, indexBuffer, drawIndexBuffer, patchBuffer };
+    mFuncs->glDeleteBuffers(5, buffers);
+
+    GLuint vaos[] = { litVao, depthVao, patchVao };
+    mFuncs->glDeleteVertexArrays(3, vaos);
+}
+
+bool GeometryArena::add(const PackedMesh &mesh, MeshRange &range)
+{
+    if (!meshes.isEmpty() && mesh.getPositionFormat() != meshes[0].getPositionFormat()) {
+        qWarning() << "GeometryArena: a mesh in another position format than the first";
+        return false;
+    }
+
+    range.firstIndex = nIndices;
+    range.indexCount = mesh.getnIndices();
+    range.baseVertex = nVerts;
+
+    meshes.append(mesh);
+    ranges.append(range);
+
+    nVerts += mesh.getnVerts();
+    nIndices += mesh.getnIndices();
+
+    // Indices are relative to baseVertex, so 16 bits are enough as long as
+    // every mesh fits on its own
+    if (mesh.getIndexType() == GL_UNSIGNED_INT)
+        indexType = GL_UNSIGNED_INT;
+
+    return true;
+}
+
+PatchRange GeometryArena::addPatches(const QVector<float> &controlPoints)
+{
+    PatchRange range;
+    range.first = patchPoints.size() / 3;
+    range.count = controlPoints.size() / 3;
+
+    patchPoints += controlPoints;
+
+    return range;
+}
+
+void GeometryArena::upload()
+{
+    int positionStride = meshes.isEmpty() ? 0 : meshes[0].positionStride();
+    int attributeStride = meshes.isEmpty() ? 0 : meshes[0].attributeStride();
+    int indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    mFuncs->glGenBuffers(1, &positionBuffer);
+    mFuncs->glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+    mFuncs->glBufferData(GL_ARRAY_BUFFER, nVerts * positionStride, NULL, GL_STATIC_DRAW);
+
+    mFuncs->glGenBuffers(1, &attributeBuffer);
+    mFuncs->glBindBuffer(GL_ARRAY_BUFFER, attributeBuffer);
+    mFuncs->glBufferData(GL_ARRAY_BUFFER, nVerts * attributeStride, NULL, GL_STATIC_DRAW);
+
+    // No VAO is bound yet, so the indices go through the copy target
+    mFuncs->glGenBuffers(1, &indexBuffer);
+    mFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+    mFuncs->glBufferData(GL_COPY_WRITE_BUFFER, nIndices * indexSize, NULL, GL_STATIC_DRAW);
+
+    for (int i = 0; i < meshes.size(); i++)
+    {
+        const PackedMesh &mesh = meshes[i];
+        const MeshRange &range = ranges[i];
+
+        mFuncs->glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        mFuncs->glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * positionStride,
+                                mesh.getPositions().size(), mesh.getPositions().constData());
+        mFuncs->glBindBuffer(GL_ARRAY_BUFFER, attributeBuffer);
+        mFuncs->glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * attributeStride,
+                                mesh.getAttributes().size(), mesh.getAttributes().constData());
+
+        // A mesh with 16-bit indices in a 32-bit arena is widened
+        QByteArray indices = mesh.getIndices();
+        if (mesh.getIndexType() != indexType) {
+            const GLushort *narrow = (const GLushort *)mesh.getIndices().constData();
+            indices.resize(mesh.getnIndices() * sizeof(GLuint));
+            GLuint *wide = (GLuint *)indices.data();
+            for (int j = 0; j < mesh.getnIndices(); j++)
+                wide[j] = narrow[j];
+        }
+        mFuncs->glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * indexSize, indices.size(), indices.constData());
+    }
+
+    reserveDraws(qMax(drawCapacity, 64));
+
+    // Lit VAO: positions, octahedral normals and texture coordinates
+    mFuncs->glGenVertexArrays(1, &litVao);
+    mFuncs->glBindVertexArray(litVao);
+
+    setPositionAttrib();
+
+    mFuncs->glBindVertexBuffer(1, attributeBuffer, 0, attributeStride);
+    mFuncs->glVertexAttribFormat(1, 2, GL_SHORT, GL_TRUE, 0);
+    mFuncs->glVertexAttribBinding(1, 1);
+    mFuncs->glVertexAttribFormat(2, 2, GL_HALF_FLOAT, GL_FALSE, 2 * sizeof(GLshort));
+    mFuncs->glVertexAttribBinding(2, 1);
+    mFuncs->glEnableVertexAttribArray(1);
+    mFuncs->glEnableVertexAttribArray(2);
+
+    mFuncs->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+    // Depth VAO: the shadow pass only fetches the position stream
+    mFuncs->glGenVertexArrays(1, &depthVao);
+    mFuncs->glBindVertexArray(depthVao);
+
+    setPositionAttrib();
+
+    mFuncs->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+    // Patch VAO: float control points and the draw index, no indices
+    if (!patchPoints.isEmpty()) {
+        mFuncs->glGenBuffers(1, &patchBuffer);
+        mFuncs->glBindBuffer(GL_ARRAY_BUFFER, patchBuffer);
+        mFuncs->glBufferData(GL_ARRAY_BUFFER, patchPoints.size() * sizeof(float), patchPoints.constData(), GL_STATIC_DRAW);
+
+        mFuncs->glGenVertexArrays(1, &patchVao);
+        mFuncs->glBindVertexArray(patchVao);
+
+        mFuncs->glBindVertexBuffer(0, patchBuffer, 0, 3 * sizeof(float));
+        mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+        mFuncs->glVertexAttribBinding(0, 0);
+        mFuncs->glEnableVertexAttribArray(0);
+
+        setDrawIndexAttrib();
+    }
+
+    mFuncs->glBindVertexArray(0);
+}
+
+// Position and draw index attributes of the bound VAO
+void GeometryArena::setPositionAttrib()
+{
+    const PackedMesh &first = meshes[0];
+
+    mFuncs->glBindVertexBuffer(0, positionBuffer, 0, first.positionStride());
+    if (first.getPositionFormat() == PackedMesh::QUANTIZED_POSITIONS)
+        mFuncs->glVertexAttribFormat(0, 4, GL_SHORT, GL_TRUE, 0);
+    else
+        mFuncs->glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+    mFuncs->glVertexAttribBinding(0, 0);
+    mFuncs->glEnableVertexAttribArray(0);
+
+    setDrawIndexAttrib();
+}
+
+// Per-instance draw index of the bound VAO
+void GeometryArena::setDrawIndexAttrib()
+{
+    mFuncs->glBindVertexBuffer(2, drawIndexBuffer, 0, sizeof(GLuint));
+    mFuncs->glVertexBindingDivisor(2, 1);
+    mFuncs->glVertexAttribIFormat(3, 1, GL_UNSIGNED_INT, 0);
+    mFuncs->glVertexAttribBinding(3, 2);
+    mFuncs->glEnableVertexAttribArray(3);
+}
+
+void GeometryArena::reserveDraws(int count)
+{
+    if (count <= drawCapacity && drawIndexBuffer != 0)
+        return;
+
+    QVector<GLuint> drawIndices(count);
+    for (int i = 0; i < count; i++)
+        drawIndices[i] = i;
+
+    // Reallocated under the same name, the VAOs keep pointing at it
+    if (drawIndexBuffer == 0)
+        mFuncs->glGenBuffers(1, &drawIndexBuffer);
+    mFuncs->glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+    mFuncs->glBufferData(GL_ARRAY_BUFFER, count * sizeof(GLuint), drawIndices.constData(), GL_STATIC_DRAW);
+    mFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    drawCapacity = count;
+}
+
+void GeometryArena::bindDrawIndices(GLuint buffer, GLintptr offset)
+{
+    mFuncs->glBindVertexBuffer(2, buffer, offset, sizeof(GLuint));
+}
+
+GLuint GeometryArena::getVao() const
+{
+    return litVao;
+}
+
+GLuint GeometryArena::getDepthVao() const
+{
+    return depthVao;
+}
+
+GLuint GeometryArena::getPatchVao() const
+{
+    return patchVao;
+}
+
+GLenum GeometryArena::getIndexType() const
+{
+    return indexType;
+}
+
+int GeometryArena::totalBytes() const
+{
+    int bytes = 0;
+    for (int i = 0; i < meshes.size(); i++)
+        bytes += meshes[i].getPositions().size() + meshes[i].getAttributes().size();
+    bytes += nIndices * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+    bytes += patchPoints.size() * sizeof(float);
+    return bytes + drawCapacity * sizeof(GLuint);
+}
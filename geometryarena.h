@@ -0,0 +1,84 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <QVector>
+#include "glcallstats.h"
+
+#include "packedmesh.h"
+
+// Where a mesh lives in the arena
+struct MeshRange
+{
+    GLuint  firstIndex;
+    GLsizei indexCount;
+    GLint   baseVertex;
+};
+
+// Control points of patches in the arena, drawn as GL_PATCHES
+struct PatchRange
+{
+    GLint   first;
+    GLsizei count;
+};
+
+// Layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+// Every packed mesh of the scene in one set of vertex and index buffers, so
+// a whole pass draws from a single VAO with one multi-draw call.
+//
+// Vertex binding 2 holds a per-instance draw index attribute (location 3),
+// 0, 1, 2, ... unless another list is bound. Each indirect command points
+// its baseInstance into that list, which is how the shaders find their
+// per-draw data on GL 4.3, where gl_DrawID is not available.
+class GeometryArena
+{
+private:
+    GlCoreFunctions *mFuncs;
+
+    QVector<PackedMesh> meshes;
+    QVector<MeshRange>  ranges;
+    int nVerts, nIndices;
+    QVector<float> patchPoints;
+
+    GLuint positionBuffer, attributeBuffer, indexBuffer, drawIndexBuffer, patchBuffer;
+    GLuint litVao, depthVao, patchVao;
+    GLenum indexType;
+    int    drawCapacity;
+
+    void setPositionAttrib();
+    void setDrawIndexAttrib();
+
+public:
+    explicit GeometryArena(GlCoreFunctions *funcs);
+    ~GeometryArena();
+
+    // Meshes are added first, then uploaded once. All of them share the
+    // position attribute, so a mesh in another position format than the
+    // first is rejected.
+    bool add(const PackedMesh &mesh, MeshRange &range);
+    // Float control points, 3 per point, with their own VAO
+    PatchRange addPatches(const QVector<float> &controlPoints);
+    void upload();
+
+    // Makes room for draw indices up to count - 1
+    void reserveDraws(int count);
+    // Points binding 2 of the bound VAO at another draw index list, e.g.
+    // the objects of a pass that survived culling in a stream buffer
+    void bindDrawIndices(GLuint buffer, GLintptr offset);
+
+    GLuint getVao() const;
+    GLuint getDepthVao() const;
+    GLuint getPatchVao() const;
+    GLenum getIndexType() const;
+    int    totalBytes() const;
+};
+
+#endif // GEOMETRYARENA_H
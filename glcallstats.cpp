@@ -0,0 +1,128 @@
+#include "glcallstats.h"
+
+#ifdef GL_CALL_STATS
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cstring>
+
+int                  GlCallStats::sPass = GlCallStats::NO_PASS;
+GlCallStats::Frame   GlCallStats::sFrame = GlCallStats::Frame();
+QVector<int>         GlCallStats::sCalls;
+QVector<int>         GlCallStats::sKinds;
+QVector<const char *> GlCallStats::sNames;
+
+static const char *KIND_NAMES[GlCallStats::KINDS] = { "bind", "state", "uniform", "upload", "draw", "sync" };
+
+// Sums over the frames since reset() and since the last report line
+static GlCallStats::Frame total, interval;
+static int totalFrames = 0, intervalFrames = 0;
+static QVector<qint64> intervalCalls;
+static QElapsedTimer intervalTimer;
+
+static void add(GlCallStats::Frame &sum, const GlCallStats::Frame &frame)
+{
+    for (int k = 0; k < GlCallStats::KINDS; k++)
+        sum.calls[k] += frame.calls[k];
+    sum.uploadBytes += frame.uploadBytes;
+    for (int p = 0; p < GlCallStats::PASSES; p++) {
+        sum.draws[p] += frame.draws[p];
+        sum.triangles[p] += frame.triangles[p];
+    }
+}
+
+static GlCallStats::Frame divide(const GlCallStats::Frame &sum, int frames)
+{
+    GlCallStats::Frame mean = sum;
+    double n = qMax(1, frames);
+    for (int k = 0; k < GlCallStats::KINDS; k++)
+        mean.calls[k] /= n;
+    mean.uploadBytes /= n;
+    for (int p = 0; p < GlCallStats::PASSES; p++) {
+        mean.draws[p] /= n;
+        mean.triangles[p] /= n;
+    }
+    return mean;
+}
+
+int GlCallStats::registerCall(const char *name, Kind kind)
+{
+    // Several call sites may share an entry point
+    for (int i = 0; i < sNames.size(); i++)
+        if (strcmp(sNames[i], name) == 0)
+            return i;
+
+    sNames.append(name);
+    sKinds.append(kind);
+    sCalls.append(0);
+    intervalCalls.append(0);
+    return sNames.size() - 1;
+}
+
+void GlCallStats::endFrame()
+{
+    add(total, sFrame);
+    add(interval, sFrame);
+    totalFrames++;
+    intervalFrames++;
+
+    for (int i = 0; i < sCalls.size(); i++)
+    {
+        intervalCalls[i] += sCalls[i];
+        sCalls[i] = 0;
+    }
+    sFrame = Frame();
+    sPass = NO_PASS;
+}
+
+GlCallStats::Frame GlCallStats::mean()
+{
+    return divide(total, totalFrames);
+}
+
+void GlCallStats::reset()
+{
+    total = Frame();
+    totalFrames = 0;
+}
+
+void GlCallStats::report(int intervalMs)
+{
+    if (!intervalTimer.isValid()) {
+        intervalTimer.start();
+        return;
+    }
+    if (intervalTimer.elapsed() < intervalMs || intervalFrames == 0)
+        return;
+
+    Frame m = divide(interval, intervalFrames);
+    double calls = 0.0;
+    for (int k = 0; k < KINDS; k++)
+        calls += m.calls[k];
+
+    printf("GL calls/frame: %.0f (", calls);
+    for (int k = 0; k < KINDS; k++)
+        printf("%s%s %.0f", k > 0 ? ", " : "", KIND_NAMES[k], m.calls[k]);
+    printf("), %.1f KB uploaded, shadow %.0f draws %.0f tris, lit %.0f draws %.0f tris\n",
+           m.uploadBytes / 1024.0, m.draws[SHADOW_PASS], m.triangles[SHADOW_PASS],
+           m.draws[LIT_PASS], m.triangles[LIT_PASS]);
+
+    // The five busiest entry points
+    QVector<int> order(sNames.size());
+    for (int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [](int a, int b) { return intervalCalls[a] > intervalCalls[b]; });
+    printf("  busiest:");
+    for (int i = 0; i < qMin(5, order.size()); i++)
+        printf(" %s %.1f", sNames[order[i]], intervalCalls[order[i]] / (double)intervalFrames);
+    printf("\n");
+    fflush(stdout);
+
+    interval = Frame();
+    intervalFrames = 0;
+    intervalCalls.fill(0);
+    intervalTimer.restart();
+}
+
+#endif // GL_CALL_STATS
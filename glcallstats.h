@@ -0,0 +1,201 @@
+#ifndef GLCALLSTATS_H
+#define GLCALLSTATS_H
+
+#include <QVector>
+#include <QOpenGLFunctions>
+#include <QOpenGLFunctions_4_3_Core>
+
+// Accounting of the GL calls the renderer makes, built with
+// CONFIG+=glstats (GL_CALL_STATS). It counts calls by entry point and
+// kind, bytes uploaded to buffers, and draw calls and triangles per pass,
+// and sums them up per frame.
+//
+// The renderer and its helpers call GL through GlFunctions and
+// GlCoreFunctions. Without GL_CALL_STATS those are Qt's own classes and the
+// stats functions below are empty inlines, so nothing is left to cost time.
+class GlCallStats
+{
+public:
+    enum Kind { BIND, STATE, UNIFORM, UPLOAD, DRAW, SYNC, KINDS };
+    enum Pass { NO_PASS, SHADOW_PASS, LIT_PASS, PASSES };
+
+    struct Frame {
+        double calls[KINDS];
+        double uploadBytes;
+        double draws[PASSES];
+        double triangles[PASSES];
+    };
+
+#ifdef GL_CALL_STATS
+    static bool enabled() { return true; }
+
+    // Draws and triangles from here on belong to pass
+    static void setPass(int pass) { sPass = pass; }
+    // Triangles of draws the wrappers cannot see, e.g. in indirect commands
+    static void addTriangles(qint64 count) { sFrame.triangles[sPass] += count; }
+
+    // Slot of an entry point, once per call site
+    static int  registerCall(const char *name, Kind kind);
+    static void count(int slot) { sCalls[slot]++; sFrame.calls[sKinds[slot]]++; }
+    static void addUpload(qint64 bytes) { sFrame.uploadBytes += bytes; }
+    static void addDraw(GLenum mode, GLsizei count, GLsizei instances)
+    {
+        sFrame.draws[sPass]++;
+        if (mode == GL_TRIANGLES)
+            sFrame.triangles[sPass] += (qint64)(count / 3) * instances;
+    }
+
+    static void  endFrame();
+    // Mean per frame since the last reset()
+    static Frame mean();
+    static void  reset();
+    // Prints the mean of the last interval and the busiest entry points
+    // once intervalMs have passed since the previous line
+    static void  report(int intervalMs);
+
+private:
+    static int            sPass;
+    static Frame          sFrame;         // The frame being recorded
+    static QVector<int>   sCalls;         // Per slot, this frame
+    static QVector<int>   sKinds;
+    static QVector<const char *> sNames;
+#else
+    static bool  enabled() { return false; }
+    static void  setPass(int) {}
+    static void  addTriangles(qint64) {}
+    static void  endFrame() {}
+    static Frame mean() { Frame f = Frame(); return f; }
+    static void  reset() {}
+    static void  report(int) {}
+#endif
+};
+
+#ifdef GL_CALL_STATS
+
+#define GL_COUNT_CALL(kind, name) \
+    static const int slot = GlCallStats::registerCall(#name, GlCallStats::kind); \
+    GlCallStats::count(slot)
+
+// Hides the entry points the renderer uses behind counting versions.
+// They are plain inline functions like Qt's, resolved at compile time, so
+// every call made through the derived type is seen.
+template <class Functions>
+class CountingFunctions : public Functions
+{
+public:
+    void glBindBuffer(GLenum target, GLuint buffer)
+    { GL_COUNT_CALL(BIND, glBindBuffer); Functions::glBindBuffer(target, buffer); }
+    void glBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    { GL_COUNT_CALL(BIND, glBindBufferBase); Functions::glBindBufferBase(target, index, buffer); }
+    void glBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    { GL_COUNT_CALL(BIND, glBindBufferRange); Functions::glBindBufferRange(target, index, buffer, offset, size); }
+    void glBindVertexArray(GLuint array)
+    { GL_COUNT_CALL(BIND, glBindVertexArray); Functions::glBindVertexArray(array); }
+    void glBindVertexBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizei stride)
+    { GL_COUNT_CALL(BIND, glBindVertexBuffer); Functions::glBindVertexBuffer(index, buffer, offset, stride); }
+    void glBindFramebuffer(GLenum target, GLuint framebuffer)
+    { GL_COUNT_CALL(BIND, glBindFramebuffer); Functions::glBindFramebuffer(target, framebuffer); }
+    void glBindTexture(GLenum target, GLuint texture)
+    { GL_COUNT_CALL(BIND, glBindTexture); Functions::glBindTexture(target, texture); }
+    void glActiveTexture(GLenum texture)
+    { GL_COUNT_CALL(BIND, glActiveTexture); Functions::glActiveTexture(texture); }
+    void glUseProgram(GLuint program)
+    { GL_COUNT_CALL(BIND, glUseProgram); Functions::glUseProgram(program); }
+
+    void glEnable(GLenum cap)
+    { GL_COUNT_CALL(STATE, glEnable); Functions::glEnable(cap); }
+    void glDisable(GLenum cap)
+    { GL_COUNT_CALL(STATE, glDisable); Functions::glDisable(cap); }
+    void glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    { GL_COUNT_CALL(STATE, glViewport); Functions::glViewport(x, y, width, height); }
+    void glCullFace(GLenum mode)
+    { GL_COUNT_CALL(STATE, glCullFace); Functions::glCullFace(mode); }
+    void glPatchParameteri(GLenum pname, GLint value)
+    { GL_COUNT_CALL(STATE, glPatchParameteri); Functions::glPatchParameteri(pname, value); }
+    void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+    { GL_COUNT_CALL(STATE, glClearColor); Functions::glClearColor(red, green, blue, alpha); }
+    void glClear(GLbitfield mask)
+    { GL_COUNT_CALL(STATE, glClear); Functions::glClear(mask); }
+
+    void glUniform1i(GLint location, GLint v0)
+    { GL_COUNT_CALL(UNIFORM, glUniform1i); Functions::glUniform1i(location, v0); }
+    void glUniformSubroutinesuiv(GLenum shadertype, GLsizei count, const GLuint *indices)
+    { GL_COUNT_CALL(UNIFORM, glUniformSubroutinesuiv); Functions::glUniformSubroutinesuiv(shadertype, count, indices); }
+
+    // Orphaning a buffer with no data uploads nothing
+    void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+    {
+        GL_COUNT_CALL(UPLOAD, glBufferData);
+        if (data != 0)
+            GlCallStats::addUpload(size);
+        Functions::glBufferData(target, size, data, usage);
+    }
+    void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+    {
+        GL_COUNT_CALL(UPLOAD, glBufferSubData);
+        GlCallStats::addUpload(size);
+        Functions::glBufferSubData(target, offset, size, data);
+    }
+    // A range mapped for writing counts as uploaded in full
+    void *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+    {
+        GL_COUNT_CALL(UPLOAD, glMapBufferRange);
+        if (access & GL_MAP_WRITE_BIT)
+            GlCallStats::addUpload(length);
+        return Functions::glMapBufferRange(target, offset, length, access);
+    }
+    GLboolean glUnmapBuffer(GLenum target)
+    { GL_COUNT_CALL(UPLOAD, glUnmapBuffer); return Functions::glUnmapBuffer(target); }
+
+    // Triangles in indirect commands are not visible here, see addTriangles
+    void glMultiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride)
+    {
+        GL_COUNT_CALL(DRAW, glMultiDrawElementsIndirect);
+        GlCallStats::addDraw(mode, 0, 0);
+        Functions::glMultiDrawElementsIndirect(mode, type, indirect, drawcount, stride);
+    }
+    void glDrawElementsInstancedBaseVertexBaseInstance(GLenum mode, GLsizei count, GLenum type, const void *indices,
+                                                       GLsizei instancecount, GLint basevertex, GLuint baseinstance)
+    {
+        GL_COUNT_CALL(DRAW, glDrawElementsInstancedBaseVertexBaseInstance);
+        GlCallStats::addDraw(mode, count, instancecount);
+        Functions::glDrawElementsInstancedBaseVertexBaseInstance(mode, count, type, indices, instancecount,
+                                                                 basevertex, baseinstance);
+    }
+    void glDrawArraysInstancedBaseInstance(GLenum mode, GLint first, GLsizei count, GLsizei instancecount,
+                                           GLuint baseinstance)
+    {
+        GL_COUNT_CALL(DRAW, glDrawArraysInstancedBaseInstance);
+        GlCallStats::addDraw(mode, count, instancecount);
+        Functions::glDrawArraysInstancedBaseInstance(mode, first, count, instancecount, baseinstance);
+    }
+
+    GLsync glFenceSync(GLenum condition, GLbitfield flags)
+    { GL_COUNT_CALL(SYNC, glFenceSync); return Functions::glFenceSync(condition, flags); }
+    GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+    { GL_COUNT_CALL(SYNC, glClientWaitSync); return Functions::glClientWaitSync(sync, flags, timeout); }
+    void glDeleteSync(GLsync sync)
+    { GL_COUNT_CALL(SYNC, glDeleteSync); Functions::glDeleteSync(sync); }
+    void glFinish()
+    { GL_COUNT_CALL(SYNC, glFinish); Functions::glFinish(); }
+    void glBeginQuery(GLenum target, GLuint id)
+    { GL_COUNT_CALL(SYNC, glBeginQuery); Functions::glBeginQuery(target, id); }
+    void glEndQuery(GLenum target)
+    { GL_COUNT_CALL(SYNC, glEndQuery); Functions::glEndQuery(target); }
+    void glGetQueryObjectuiv(GLuint id, GLenum pname, GLuint *params)
+    { GL_COUNT_CALL(SYNC, glGetQueryObjectuiv); Functions::glGetQueryObjectuiv(id, pname, params); }
+    void glGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params)
+    { GL_COUNT_CALL(SYNC, glGetQueryObjectui64v); Functions::glGetQueryObjectui64v(id, pname, params); }
+};
+
+typedef CountingFunctions<QOpenGLFunctions>          GlFunctions;
+typedef CountingFunctions<QOpenGLFunctions_4_3_Core> GlCoreFunctions;
+
+#else
+
+typedef QOpenGLFunctions          GlFunctions;
+typedef QOpenGLFunctions_4_3_Core GlCoreFunctions;
+
+#endif // GL_CALL_STATS
+
+#endif // GLCALLSTATS_H
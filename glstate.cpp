@@ -0,0 +1,192 @@
+#include "glstate.h"
+
+// Sentinel for state not known since the last invalidate()
+static const GLuint UNKNOWN = 0xffffffffu;
+
+static quint64 pairKey(quint32 a, quint32 b)
+{
+    return ((quint64)a << 32) | b;
+}
+
+GlState::GlState(GlCoreFunctions *funcs)
+    : mFuncs(funcs), caching(true), calls(0), redundant(0)
+{
+    invalidate();
+}
+
+void GlState::setCaching(bool enabled)
+{
+    caching = enabled;
+}
+
+void GlState::invalidate()
+{
+    program = vao = framebuffer = activeTexture = UNKNOWN;
+    for (int i = 0; i < 4; i++)
+        viewportRect[i] = -1;
+    cullMode = UNKNOWN;
+    patchVertexCount = -1;
+    capabilities.clear();
+    buffers.clear();
+    indexedBuffers.clear();
+    textures.clear();
+    uniforms.clear();
+    subroutines.clear();
+}
+
+// Counts a call and tells whether it has to be issued
+bool GlState::changed(bool same)
+{
+    calls++;
+    if (same)
+        redundant++;
+    return !same || !caching;
+}
+
+void GlState::useProgram(GLuint p)
+{
+    if (!changed(p == program))
+        return;
+    mFuncs->glUseProgram(p);
+    program = p;
+    // glUseProgram resets the subroutine selections, even for the same program
+    subroutines.clear();
+}
+
+void GlState::uniform1i(GLint location, GLint value)
+{
+    quint64 key = pairKey(program, location);
+    QHash<quint64, GLint>::const_iterator it = uniforms.constFind(key);
+    if (!changed(program != UNKNOWN && it != uniforms.constEnd() && it.value() == value))
+        return;
+    mFuncs->glUniform1i(location, value);
+    uniforms.insert(key, value);
+}
+
+void GlState::uniformSubroutine(GLenum stage, GLuint index)
+{
+    QHash<GLenum, GLuint>::const_iterator it = subroutines.constFind(stage);
+    if (!changed(it != subroutines.constEnd() && it.value() == index))
+        return;
+    mFuncs->glUniformSubroutinesuiv(stage, 1, &index);
+    subroutines.insert(stage, index);
+}
+
+void GlState::bindVertexArray(GLuint v)
+{
+    if (!changed(v == vao))
+        return;
+    mFuncs->glBindVertexArray(v);
+    vao = v;
+    // The element array binding belongs to the VAO
+    buffers.remove(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+void GlState::bindFramebuffer(GLuint f)
+{
+    if (!changed(f == framebuffer))
+        return;
+    mFuncs->glBindFramebuffer(GL_FRAMEBUFFER, f);
+    framebuffer = f;
+}
+
+void GlState::bindBuffer(GLenum target, GLuint buffer)
+{
+    QHash<GLenum, GLuint>::const_iterator it = buffers.constFind(target);
+    if (!changed(it != buffers.constEnd() && it.value() == buffer))
+        return;
+    mFuncs->glBindBuffer(target, buffer);
+    buffers.insert(target, buffer);
+}
+
+void GlState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    bindBufferRange(target, index, buffer, 0, 0);
+}
+
+void GlState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    quint64 key = pairKey(target, index);
+    QHash<quint64, IndexedBinding>::const_iterator it = indexedBuffers.constFind(key);
+    bool same = it != indexedBuffers.constEnd() && it.value().buffer == buffer
+            && it.value().offset == offset && it.value().size == size;
+    if (!changed(same))
+        return;
+
+    if (size == 0)
+        mFuncs->glBindBufferBase(target, index, buffer);
+    else
+        mFuncs->glBindBufferRange(target, index, buffer, offset, size);
+
+    IndexedBinding binding = { buffer, offset, size };
+    indexedBuffers.insert(key, binding);
+    // Both also bind the generic target
+    buffers.insert(target, buffer);
+}
+
+void GlState::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    quint64 key = pairKey(unit, target);
+    QHash<quint64, GLuint>::const_iterator it = textures.constFind(key);
+    if (!changed(it != textures.constEnd() && it.value() == texture))
+        return;
+
+    if (activeTexture != unit || !caching) {
+        mFuncs->glActiveTexture(GL_TEXTURE0 + unit);
+        activeTexture = unit;
+    }
+    mFuncs->glBindTexture(target, texture);
+    textures.insert(key, texture);
+}
+
+void GlState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    bool same = viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height;
+    if (!changed(same))
+        return;
+    mFuncs->glViewport(x, y, width, height);
+    viewportRect[0] = x; viewportRect[1] = y; viewportRect[2] = width; viewportRect[3] = height;
+}
+
+void GlState::setEnabled(GLenum cap, bool enabled)
+{
+    QHash<GLenum, int>::const_iterator it = capabilities.constFind(cap);
+    if (!changed(it != capabilities.constEnd() && it.value() == (enabled ? 1 : 0)))
+        return;
+    if (enabled)
+        mFuncs->glEnable(cap);
+    else
+        mFuncs->glDisable(cap);
+    capabilities.insert(cap, enabled ? 1 : 0);
+}
+
+void GlState::cullFace(GLenum mode)
+{
+    if (!changed(mode == cullMode))
+        return;
+    mFuncs->glCullFace(mode);
+    cullMode = mode;
+}
+
+void GlState::patchVertices(GLint count)
+{
+    if (!changed(count == patchVertexCount))
+        return;
+    mFuncs->glPatchParameteri(GL_PATCH_VERTICES, count);
+    patchVertexCount = count;
+}
+
+int GlState::getCalls() const
+{
+    return calls;
+}
+
+int GlState::getRedundant() const
+{
+    return redundant;
+}
+
+void GlState::resetCounts()
+{
+    calls = redundant = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <QHash>
+#include "glcallstats.h"
+
+// Remembers the GL state the frame loop sets and skips calls that would
+// not change it: program, VAO, framebuffer, buffer bindings, textures,
+// viewport, culling and the uniforms and subroutines set per pass.
+//
+// Code that changes state behind its back (setup, Qt itself) must be
+// followed by invalidate(); the frame loop invalidates once per frame, so
+// nothing is assumed across a buffer swap. With caching off every call is
+// issued, redundant ones are still counted.
+class GlState
+{
+private:
+    struct IndexedBinding {
+        GLuint     buffer;
+        GLintptr   offset;
+        GLsizeiptr size;        // 0 for the whole buffer
+    };
+
+    GlCoreFunctions *mFuncs;
+    bool caching;
+
+    GLuint program, vao, framebuffer, activeTexture;
+    GLint  viewportRect[4];
+    GLenum cullMode;
+    GLint  patchVertexCount;
+    QHash<GLenum, int>      capabilities;     // 0 or 1, missing = unknown
+    QHash<GLenum, GLuint>   buffers;
+    QHash<quint64, IndexedBinding> indexedBuffers;   // Target and index
+    QHash<quint64, GLuint>  textures;         // Unit and target
+    QHash<quint64, GLint>   uniforms;         // Program and location
+    QHash<GLenum, GLuint>   subroutines;      // Per stage, lost when the program changes
+
+    int calls, redundant;
+
+    bool changed(bool same);
+
+public:
+    explicit GlState(GlCoreFunctions *funcs);
+
+    void setCaching(bool enabled);
+    void invalidate();
+
+    void useProgram(GLuint program);
+    void uniform1i(GLint location, GLint value);
+    // Selects one subroutine for the single subroutine uniform of a stage
+    void uniformSubroutine(GLenum stage, GLuint index);
+
+    void bindVertexArray(GLuint vao);
+    void bindFramebuffer(GLuint framebuffer);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void setEnabled(GLenum cap, bool enabled);
+    void cullFace(GLenum mode);
+    void patchVertices(GLint count);
+
+    // Tracked calls and how many of them were redundant since the last reset
+    int  getCalls() const;
+    int  getRedundant() const;
+    void resetCounts();
+};
+
+#endif // GLSTATE_H
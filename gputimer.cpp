@@ -0,0 +1,229 @@
+#include "gputimer.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+GpuTimer::GpuTimer(GlCoreFunctions *f, int latency, int window)
+    : gl(f), windowSize(window), frameCount(0), openScope(-1), droppedFrames(0)
+{
+    ring.resize(latency);
+    for (int i = 0; i < ring.size(); i++) {
+        ring[i].used = 0;
+        ring[i].frame = 0;
+        ring[i].pending = false;
+    }
+}
+
+GpuTimer::~GpuTimer()
+{
+    for (int i = 0; i < ring.size(); i++)
+        for (int q = 0; q < ring[i].queries.size(); q++)
+            gl->glDeleteQueries(1, &ring[i].queries[q].id);
+}
+
+int GpuTimer::scopeId(const QString &name)
+{
+    QHash<QString, int>::const_iterator it = scopeIndex.constFind(name);
+    if (it != scopeIndex.constEnd())
+        return it.value();
+
+    int id = scopeNames.size();
+    scopeNames.append(name);
+    scopeIndex.insert(name, id);
+    scopeStats.append(FrameStats(windowSize));
+
+    return id;
+}
+
+// Reads back the queries of one frame. Without wait this only succeeds when
+// every result is already available, so it never blocks.
+bool GpuTimer::collect(FrameSlot &slot, bool wait)
+{
+    if (!slot.pending)
+        return true;
+
+    if (!wait) {
+        for (int q = 0; q < slot.used; q++) {
+            GLuint available = GL_FALSE;
+            gl->glGetQueryObjectuiv(slot.queries[q].id, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return false;
+        }
+    }
+
+    // A scope may be opened several times per frame (e.g. one draw per plane),
+    // its samples are summed into a single per-frame value.
+    QVector<double> frameMs(scopeNames.size(), -1.0);
+    for (int q = 0; q < slot.used; q++) {
+        GLuint64 ns = 0;
+        gl->glGetQueryObjectui64v(slot.queries[q].id, GL_QUERY_RESULT, &ns);
+        int scope = slot.queries[q].scope;
+        frameMs[scope] = qMax(frameMs[scope], 0.0) + ns / 1.0e6;
+    }
+
+    for (int s = 0; s < frameMs.size(); s++) {
+        if (frameMs[s] < 0.0)
+            continue;
+        scopeStats[s].add(frameMs[s]);
+
+        Sample sample;
+        sample.frame = slot.frame;
+        sample.scope = s;
+        sample.ms = frameMs[s];
+        history.append(sample);
+    }
+
+    slot.pending = false;
+    return true;
+}
+
+void GpuTimer::beginFrame()
+{
+    // Oldest frame first, which is the slot about to be reused; stop at the
+    // first one the GPU has not finished yet
+    for (int k = 0; k < ring.size(); k++) {
+        if (!collect(ring[(frameCount + k) % ring.size()], false))
+            break;
+    }
+
+    FrameSlot &slot = ring[frameCount % ring.size()];
+    if (slot.pending) {
+        // The ring is too shallow for the current GPU latency: drop the frame
+        // rather than wait for it.
+        slot.pending = false;
+        droppedFrames++;
+    }
+    slot.used = 0;
+    slot.frame = frameCount;
+}
+
+void GpuTimer::endFrame()
+{
+    if (openScope >= 0)
+        end();
+
+    FrameSlot &slot = ring[frameCount % ring.size()];
+    slot.pending = slot.used > 0;
+    frameCount++;
+}
+
+void GpuTimer::begin(const QString &name)
+{
+    if (openScope >= 0) {
+        qWarning() << "GpuTimer: scope" << name << "opened while" << scopeNames[openScope] << "is still open";
+        return;
+    }
+
+    FrameSlot &slot = ring[frameCount % ring.size()];
+    if (slot.used == slot.queries.size()) {
+        Query query;
+        gl->glGenQueries(1, &query.id);
+        slot.queries.append(query);
+    }
+
+    Query &query = slot.queries[slot.used++];
+    query.scope = scopeId(name);
+    openScope = query.scope;
+
+    gl->glBeginQuery(GL_TIME_ELAPSED, query.id);
+}
+
+void GpuTimer::end()
+{
+    if (openScope < 0)
+        return;
+
+    gl->glEndQuery(GL_TIME_ELAPSED);
+    openScope = -1;
+}
+
+// Blocks until every outstanding query has been read back. Only meant for
+// the end of a run (shutdown, between benchmark runs), never per frame.
+void GpuTimer::flush()
+{
+    for (int k = 0; k < ring.size(); k++)
+        collect(ring[(frameCount + k) % ring.size()], true);
+}
+
+// Forgets all collected samples, e.g. between benchmark runs
+void GpuTimer::reset()
+{
+    for (int s = 0; s < scopeStats.size(); s++)
+        scopeStats[s].clear();
+    history.clear();
+}
+
+QStringList GpuTimer::scopes() const
+{
+    return scopeNames;
+}
+
+const FrameStats &GpuTimer::stats(const QString &name) const
+{
+    static const FrameStats empty;
+
+    QHash<QString, int>::const_iterator it = scopeIndex.constFind(name);
+    if (it == scopeIndex.constEnd())
+        return empty;
+
+    return scopeStats[it.value()];
+}
+
+int GpuTimer::getDroppedFrames() const
+{
+    return droppedFrames;
+}
+
+bool GpuTimer::writeCsv(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write" << fileName;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "frame,scope,ms\n";
+    for (int i = 0; i < history.size(); i++)
+        out << history[i].frame << "," << scopeNames[history[i].scope] << "," << history[i].ms << "\n";
+
+    return true;
+}
+
+bool GpuTimer::writeJson(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write" << fileName;
+        return false;
+    }
+
+    // Summary over the whole run, not only the rolling window
+    QVector<FrameStats> total(scopeNames.size());
+    for (int i = 0; i < history.size(); i++)
+        total[history[i].scope].add(history[i].ms);
+
+    QJsonObject scopesObject;
+    for (int s = 0; s < scopeNames.size(); s++) {
+        QJsonObject scope;
+        scope["count"] = total[s].count();
+        scope["mean_ms"] = total[s].mean();
+        scope["p50_ms"] = total[s].percentile(50.0);
+        scope["p99_ms"] = total[s].percentile(99.0);
+        scope["min_ms"] = total[s].min();
+        scope["max_ms"] = total[s].max();
+        scopesObject[scopeNames[s]] = scope;
+    }
+
+    QJsonObject root;
+    root["frames"] = (double)frameCount;
+    root["dropped_frames"] = droppedFrames;
+    root["scopes"] = scopesObject;
+
+    file.write(QJsonDocument(root).toJson());
+
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <QVector>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include "glcallstats.h"
+#include "framestats.h"
+
+// Measures GPU time of named scopes with GL_TIME_ELAPSED queries.
+//
+// Queries are kept in a ring that is several frames deep: the results of a
+// frame are only read once the GPU reports them available, so collecting
+// them never stalls the pipeline. GL_TIME_ELAPSED queries cannot nest, so
+// only one scope may be open at a time.
+class GpuTimer
+{
+private:
+    struct Query {
+        GLuint id;
+        int    scope;
+    };
+
+    struct FrameSlot {
+        QVector<Query> queries;
+        int    used;
+        qint64 frame;
+        bool   pending;
+    };
+
+    struct Sample {
+        qint64 frame;
+        int    scope;
+        double ms;
+    };
+
+    GlCoreFunctions *gl;
+
+    QVector<FrameSlot>  ring;
+    QStringList         scopeNames;
+    QHash<QString, int> scopeIndex;
+    QVector<FrameStats> scopeStats;
+    QVector<Sample>     history;
+    int    windowSize;
+    qint64 frameCount;
+    int    openScope;
+    int    droppedFrames;
+
+    int  scopeId(const QString &name);
+    bool collect(FrameSlot &slot, bool wait);
+
+public:
+    GpuTimer(GlCoreFunctions *f, int latency = 4, int window = 240);
+    ~GpuTimer();
+
+    void beginFrame();
+    void endFrame();
+    void begin(const QString &name);
+    void end();
+    void flush();
+    void reset();
+
+    QStringList      scopes() const;
+    const FrameStats &stats(const QString &name) const;
+    int              getDroppedFrames() const;
+
+    bool writeCsv(const QString &fileName) const;
+    bool writeJson(const QString &fileName) const;
+};
+
+#endif // GPUTIMER_H
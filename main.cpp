@@ -1,13 +1,259 @@
 #include "ShadowMap.h"
+#include "cachereport.h"
+#include "cullbench.h"
+#include "tessbench.h"
 
 #include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QStandardPaths>
+
+#include <cstring>
+
+// Reads an integer option value in min..max. A typo must not silently
+// become 0, so anything else is reported and rejected.
+static bool intOption(const char *name, const QString &text, int min, int max, int &value)
+{
+    bool ok = false;
+    value = text.toInt(&ok);
+    if (!ok || value < min || value > max) {
+        qWarning( "Invalid --%s '%s', expected an integer from %d to %d", name, text.toLatin1().constData(), min, max );
+        return false;
+    }
+    return true;
+}
+
+// The same for a float option
+static bool floatOption(const char *name, const QString &text, float min, float max, float &value)
+{
+    bool ok = false;
+    value = text.toFloat(&ok);
+    if (!ok || value < min || value > max) {
+        qWarning( "Invalid --%s '%s', expected a number from %g to %g", name, text.toLatin1().constData(), min, max );
+        return false;
+    }
+    return true;
+}
+
+// A comma separated list of integers
+static bool intListOption(const char *name, const QString &text, int min, int max, QList<int> &values)
+{
+    QStringList items = text.split(',');
+    for (int i = 0; i < items.size(); i++)
+    {
+        int value;
+        if (!intOption(name, items[i], min, max, value))
+            return false;
+        values.append(value);
+    }
+    return true;
+}
 
 int main(int argc, char *argv[])
 {
+    // The platform plugin is chosen when QGuiApplication is constructed, so
+    // the headless switches have to be looked at before the parser runs.
+    // An explicit QT_QPA_PLATFORM is kept, xcb and eglfs then need a display.
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--headless") == 0 || strcmp(argv[i], "--vcache-report") == 0
+             || strcmp(argv[i], "--cull-bench") == 0 || strcmp(argv[i], "--tess-bench") == 0)
+                && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        if (strcmp(argv[i], "--software") == 0) {
+            qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+            qputenv("GALLIUM_DRIVER", "llvmpipe");
+        }
+    }
+
     QGuiApplication a(argc, argv);
 
-    MyWindow *window = new MyWindow();
-    window->show();
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Shadow map demo");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("headless", "Render offscreen and run the benchmark instead of opening a window."));
+    parser.addOption(QCommandLineOption("software", "Force the Mesa llvmpipe software rasterizer."));
+    parser.addOption(QCommandLineOption("frames", "Number of benchmark frames.", "count", "500"));
+    parser.addOption(QCommandLineOption("warmup", "Number of untimed frames before the benchmark.", "count", "20"));
+    parser.addOption(QCommandLineOption("size", "Render target size for the benchmark.", "WxH", "800x600"));
+    parser.addOption(QCommandLineOption("gpu-stats", "Write GPU timings to <file>.csv and <file>.json on exit.", "file"));
+    parser.addOption(QCommandLineOption("gpu-timing-per-draw", "Time every object draw instead of whole passes."));
+    parser.addOption(QCommandLineOption("no-depth-program", "Render the shadow map with the full scene program."));
+    parser.addOption(QCommandLineOption("teapot-grid", "Tessellation of each teapot patch.", "n", "14"));
+    parser.addOption(QCommandLineOption("stress", "Replace the scene with n instanced teapots and tori.", "n", "0"));
+    parser.addOption(QCommandLineOption("stress-random", "Scatter the stress scene objects randomly instead of on a grid."));
+    parser.addOption(QCommandLineOption("no-index-optimize", "Keep the generated triangle order."));
+    parser.addOption(QCommandLineOption("overdraw-order", "Sort triangle clusters to reduce overdraw after the cache optimization."));
+    parser.addOption(QCommandLineOption("vcache-report", "Print vertex cache statistics of the meshes at the given grids and exit.", "grids"));
+    parser.addOption(QCommandLineOption("vcache-size", "Vertex cache size for --vcache-report.", "n", "16"));
+    parser.addOption(QCommandLineOption("float-positions", "Keep mesh positions as floats instead of quantizing them."));
+    parser.addOption(QCommandLineOption("no-shadow-cache", "Re-render the shadow map every frame."));
+    parser.addOption(QCommandLineOption("shadow-size", "Shadow map resolution.", "n", "512"));
+    parser.addOption(QCommandLineOption("shadow-format", "Shadow map depth format: 16, 24 or 32f.", "format", "24"));
+    parser.addOption(QCommandLineOption("pcf", "Shadow filter kernel: none, 2x2, 3x3, 5x5, 7x7, 9x9, poisson.", "kernel", "none"));
+    parser.addOption(QCommandLineOption("shadow-filter", "Shadow map type: pcf on depth, vsm or esm moments blurred in a compute pass.", "type", "pcf"));
+    parser.addOption(QCommandLineOption("shadow-blur", "Radius in texels of the blur of the vsm/esm moments.", "n", "2"));
+    parser.addOption(QCommandLineOption("esm-exponent", "Sharpness of the exponential shadow map.", "c", "40"));
+    parser.addOption(QCommandLineOption("cascades", "Number of cascaded shadow maps, 0 for a single map.", "n", "0"));
+    parser.addOption(QCommandLineOption("cascade-lambda", "Cascade split blend, 0 uniform to 1 logarithmic.", "lambda", "0.75"));
+    parser.addOption(QCommandLineOption("cascade-far", "Distance covered by the cascades.", "dist", "40"));
+    parser.addOption(QCommandLineOption("cascade-timing", "Render and time each cascade in its own pass."));
+    parser.addOption(QCommandLineOption("no-culling", "Draw every object in both passes instead of frustum culling them."));
+    parser.addOption(QCommandLineOption("cull-bench", "Time the culling kernels on the given object counts and exit.", "counts"));
+    parser.addOption(QCommandLineOption("gpu-teapot", "Tessellate the teapot patches on the GPU instead of at a fixed grid."));
+    parser.addOption(QCommandLineOption("tess-pixels", "Target screen size of a GPU tessellated edge in pixels.", "px", "8"));
+    parser.addOption(QCommandLineOption("tess-shadow-scale", "Tessellation level of the shadow pass relative to the lit pass.", "scale", "0.5"));
+    parser.addOption(QCommandLineOption("lod", "Draw coarser levels of the teapot and torus as they get smaller on screen, off by default."));
+    parser.addOption(QCommandLineOption("lod-pixels", "Projected object size in pixels below which a coarser level is drawn.", "px", "256"));
+    parser.addOption(QCommandLineOption("shadow-lod-bias", "Levels coarser the shadow pass draws than the lit pass.", "levels", "1"));
+    parser.addOption(QCommandLineOption("lod-hysteresis", "Fraction of a level the size must pass a boundary by to switch.", "h", "0.2"));
+    parser.addOption(QCommandLineOption("mesh-cache", "Directory of the packed mesh cache.", "dir",
+                                        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes"));
+    parser.addOption(QCommandLineOption("no-mesh-cache", "Generate the meshes every run."));
+    parser.addOption(QCommandLineOption("mesh-cache-clear", "Empty the mesh cache before starting, for a cold start."));
+    parser.addOption(QCommandLineOption("program-cache", "Directory of the linked shader program binaries.", "dir",
+                                        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs"));
+    parser.addOption(QCommandLineOption("no-program-cache", "Compile the shaders from source every run."));
+    parser.addOption(QCommandLineOption("frame-loop", "Window frame loop: vsync (update requests) or timer (1 ms tick and 16 ms repaint timers).", "loop", "vsync"));
+    parser.addOption(QCommandLineOption("swap-interval", "Frames per buffer swap in either frame loop, 0 to disable vsync.", "n", "1"));
+    parser.addOption(QCommandLineOption("loop-stats", "Print event loop wakeups and frame interval jitter every 5 seconds."));
+    parser.addOption(QCommandLineOption("stream-regions", "Frames in flight in the per-frame stream buffer.", "n", "3"));
+    parser.addOption(QCommandLineOption("no-state-cache", "Issue every bind and enable of the frame loop, even redundant ones."));
+    parser.addOption(QCommandLineOption("capture", "Record every frame to a file, raw RGBA or Y4M.", "file"));
+    parser.addOption(QCommandLineOption("capture-format", "Capture file format: raw or y4m, by default from the file extension.", "format"));
+    parser.addOption(QCommandLineOption("capture-ring", "Frame readbacks in flight before frames are dropped.", "n", "3"));
+    parser.addOption(QCommandLineOption("tess-bench", "Time the teapot generation at the given grids and exit.", "grids"));
+    parser.addOption(QCommandLineOption("sweep", "Benchmark sweep to run in headless mode: depth-program, shadow-cache, pcf, shadow-filter, shadow-format, stress, tessellation, lod.", "name"));
+    parser.process(a);
+
+    if (parser.isSet("vcache-report"))
+    {
+        QList<int> grids;
+        int cacheSize;
+        if (!intListOption("vcache-report", parser.value("vcache-report"), 1, 1024, grids)
+                || !intOption("vcache-size", parser.value("vcache-size"), 1, 1024, cacheSize))
+            return 1;
+
+        return runVertexCacheReport(grids, cacheSize);
+    }
+
+    if (parser.isSet("cull-bench"))
+    {
+        QList<int> counts;
+        if (!intListOption("cull-bench", parser.value("cull-bench"), 1, 10000000, counts))
+            return 1;
+
+        return runCullingBenchmark(counts);
+    }
+
+    if (parser.isSet("tess-bench"))
+    {
+        QList<int> grids;
+        if (!intListOption("tess-bench", parser.value("tess-bench"), 1, 1024, grids))
+            return 1;
+
+        return runTessellationBenchmark(grids);
+    }
+
+    RenderOptions options;
+    options.gpuStatsFile = parser.value("gpu-stats");
+    options.perDrawGpuTiming = parser.isSet("gpu-timing-per-draw");
+    options.depthOnlyShadowPass = !parser.isSet("no-depth-program");
+    // The grid is part of the mesh cache key, a bad one would be cached too
+    if (!intOption("teapot-grid", parser.value("teapot-grid"), 1, 512, options.teapotGrid)
+            || !intOption("stress", parser.value("stress"), 0, 100000, options.stressCount))
+        return 1;
+    options.stressRandom = parser.isSet("stress-random");
+    options.optimizeIndices = !parser.isSet("no-index-optimize");
+    options.overdrawOrder = parser.isSet("overdraw-order");
+    options.quantizePositions = !parser.isSet("float-positions");
+    options.shadowCache = !parser.isSet("no-shadow-cache");
+    if (!intOption("shadow-size", parser.value("shadow-size"), 16, 16384, options.shadowMapSize))
+        return 1;
+    options.shadowFormat = parser.value("shadow-format");
+    if (options.shadowFormat != "16" && options.shadowFormat != "24" && options.shadowFormat != "32f") {
+        qWarning( "Invalid --shadow-format, expected 16, 24 or 32f" );
+        return 1;
+    }
+    options.pcfKernel = parser.value("pcf");
+    if (!QStringList({"none", "2x2", "3x3", "5x5", "7x7", "9x9", "poisson"}).contains(options.pcfKernel)) {
+        qWarning( "Invalid --pcf, expected none, 2x2, 3x3, 5x5, 7x7, 9x9 or poisson" );
+        return 1;
+    }
+    // The cascades cannot reach past the far plane of the camera
+    if (!intOption("cascades", parser.value("cascades"), 0, MAX_CASCADES, options.cascades)
+            || !floatOption("cascade-lambda", parser.value("cascade-lambda"), 0.0f, 1.0f, options.cascadeLambda)
+            || !floatOption("cascade-far", parser.value("cascade-far"), 1.0f, 100.0f, options.cascadeFar))
+        return 1;
+    options.perCascadeTiming = parser.isSet("cascade-timing");
+    options.shadowFilter = parser.value("shadow-filter");
+    if (options.shadowFilter != "pcf" && options.shadowFilter != "vsm" && options.shadowFilter != "esm") {
+        qWarning( "Invalid --shadow-filter, expected pcf, vsm or esm" );
+        return 1;
+    }
+    if (options.shadowFilter != "pcf" && options.cascades > 0) {
+        qWarning( "--shadow-filter vsm and esm only support the single shadow map, not --cascades" );
+        return 1;
+    }
+    if (!intOption("shadow-blur", parser.value("shadow-blur"), 0, 16, options.shadowBlur)
+            || !floatOption("esm-exponent", parser.value("esm-exponent"), 1.0f, 80.0f, options.esmExponent))
+        return 1;
+    options.frustumCulling = !parser.isSet("no-culling");
+    options.gpuTessellation = parser.isSet("gpu-teapot");
+    if (!floatOption("tess-pixels", parser.value("tess-pixels"), 0.5f, 1024.0f, options.tessPixelsPerEdge)
+            || !floatOption("tess-shadow-scale", parser.value("tess-shadow-scale"), 0.01f, 1.0f, options.tessShadowScale))
+        return 1;
+    options.meshLod = parser.isSet("lod");
+    if (!floatOption("lod-pixels", parser.value("lod-pixels"), 1.0f, 16384.0f, options.lodPixels)
+            || !floatOption("shadow-lod-bias", parser.value("shadow-lod-bias"), -8.0f, 8.0f, options.shadowLodBias)
+            || !floatOption("lod-hysteresis", parser.value("lod-hysteresis"), 0.0f, 0.5f, options.lodHysteresis))
+        return 1;
+    options.meshCacheDir = parser.isSet("no-mesh-cache") ? QString() : parser.value("mesh-cache");
+    options.meshCacheClear = parser.isSet("mesh-cache-clear");
+    options.programCacheDir = parser.isSet("no-program-cache") ? QString() : parser.value("program-cache");
+    options.frameLoop = parser.value("frame-loop");
+    if (options.frameLoop != "vsync" && options.frameLoop != "timer") {
+        qWarning( "Invalid --frame-loop, expected vsync or timer" );
+        return 1;
+    }
+    if (!intOption("swap-interval", parser.value("swap-interval"), 0, 8, options.swapInterval))
+        return 1;
+    options.loopStats = parser.isSet("loop-stats");
+    if (!intOption("stream-regions", parser.value("stream-regions"), 1, 8, options.streamRegions))
+        return 1;
+    options.glStateCache = !parser.isSet("no-state-cache");
+    options.captureFile = parser.value("capture");
+    options.captureFormat = parser.value("capture-format");
+    if (options.captureFormat.isEmpty())
+        options.captureFormat = options.captureFile.endsWith(".y4m", Qt::CaseInsensitive) ? "y4m" : "raw";
+    if (options.captureFormat != "raw" && options.captureFormat != "y4m") {
+        qWarning( "Invalid --capture-format, expected raw or y4m" );
+        return 1;
+    }
+    if (!intOption("capture-ring", parser.value("capture-ring"), 2, 16, options.captureRing))
+        return 1;
+    options.sweep = parser.value("sweep");
+
+    if (parser.isSet("headless"))
+    {
+        QStringList dims = parser.value("size").split('x');
+        int w, h, frames, warmup;
+        if (dims.size() != 2) {
+            qWarning( "Invalid --size, expected WxH" );
+            return 1;
+        }
+        if (!intOption("size", dims[0], 1, 16384, w) || !intOption("size", dims[1], 1, 16384, h)
+                || !intOption("frames", parser.value("frames"), 1, 1000000, frames)
+                || !intOption("warmup", parser.value("warmup"), 0, 1000000, warmup))
+            return 1;
+
+        MyWindow window(true, options);
+        window.resize(w, h);
+
+        return window.runBenchmark(frames, warmup);
+    }
+
+    MyWindow window(false, options);
+    window.show();
 
     return a.exec();
 }
@@ -0,0 +1,239 @@
+#include "meshcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QCryptographicHash>
+
+#include <cstring>
+#include <cstddef>
+
+static const char    CACHE_MAGIC[8] = { 'S', 'M', 'M', 'E', 'S', 'H', 0, 0 };
+// Bump whenever a generator, the index optimizer or the packing changes
+// what they produce, old files then fail the version check
+static const quint32 CACHE_VERSION = 1;
+static const quint32 CACHE_BYTE_ORDER = 0x01020304;
+
+struct CacheHeader
+{
+    char    magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 keySize;
+    quint32 levelCount;
+    float   center[3];
+    float   extent[3];
+    quint64 tableChecksum;      // Header with this field 0, key and level table
+};
+
+struct CacheLevel
+{
+    qint32  nVerts;
+    qint32  nIndices;
+    qint32  positionFormat;
+    qint32  reserved;
+    float   positionTransform[16];
+    quint64 offset[3];          // Positions, attributes, indices
+    quint64 size[3];
+    quint64 checksum[3];
+};
+
+static qint64 align16(qint64 offset)
+{
+    return (offset + 15) & ~(qint64)15;
+}
+
+MeshCache::MeshCache(const QString &directory)
+    : directory(directory), hits(0), misses(0)
+{
+    QDir().mkpath(directory);
+}
+
+MeshCache::~MeshCache()
+{
+    qDeleteAll(mappedFiles);
+}
+
+QString MeshCache::fileName(const QString &key) const
+{
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return directory + "/" + QString::fromLatin1(hash) + ".mesh";
+}
+
+quint64 MeshCache::checksum(const char *data, qint64 size)
+{
+    quint64 a = 1, b = 0;
+    qint64 i = 0;
+    for (; i + 4 <= size; i += 4) {
+        quint32 word;
+        memcpy(&word, data + i, sizeof(word));
+        a += word;
+        b += a;
+    }
+
+    quint32 tail = 0;
+    memcpy(&tail, data + i, size - i);
+    a += tail;
+    b += a;
+
+    return b ^ (a * 0x9e3779b97f4a7c15ULL) ^ (quint64)size;
+}
+
+bool MeshCache::load(const QString &key, QVector<PackedMesh> &meshes, QVector3D &center, QVector3D &extent)
+{
+    QFile *file = new QFile(fileName(key));
+    if (!file->open(QIODevice::ReadOnly) || file->size() < (qint64)sizeof(CacheHeader)) {
+        delete file;
+        misses++;
+        return false;
+    }
+
+    const char *data = (const char *)file->map(0, file->size());
+    qint64 fileSize = file->size();
+    if (data == 0) {
+        delete file;
+        misses++;
+        return false;
+    }
+
+    // Everything up to the streams is checked before any of it is trusted
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    QByteArray keyBytes = key.toUtf8();
+    qint64 tableOffset = align16(sizeof(CacheHeader) + header.keySize);
+    qint64 tableEnd = tableOffset + (qint64)header.levelCount * sizeof(CacheLevel);
+
+    bool valid = memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+            && header.version == CACHE_VERSION && header.byteOrder == CACHE_BYTE_ORDER
+            && header.levelCount > 0 && tableEnd <= fileSize
+            && header.keySize == (quint32)keyBytes.size()
+            && memcmp(data + sizeof(CacheHeader), keyBytes.constData(), keyBytes.size()) == 0;
+    if (valid) {
+        QByteArray table(data, tableEnd);
+        memset(table.data() + offsetof(CacheHeader, tableChecksum), 0, sizeof(quint64));
+        valid = checksum(table.constData(), table.size()) == header.tableChecksum;
+    }
+
+    QVector<PackedMesh> loaded;
+    for (quint32 l = 0; valid && l < header.levelCount; l++)
+    {
+        CacheLevel level;
+        memcpy(&level, data + tableOffset + l * sizeof(CacheLevel), sizeof(level));
+
+        QByteArray streams[3];
+        for (int s = 0; s < 3 && valid; s++) {
+            valid = level.offset[s] + level.size[s] <= (quint64)fileSize
+                    && checksum(data + level.offset[s], level.size[s]) == level.checksum[s];
+            if (valid)
+                streams[s] = QByteArray::fromRawData(data + level.offset[s], level.size[s]);
+        }
+        if (!valid)
+            break;
+
+        QMatrix4x4 transform;
+        memcpy(transform.data(), level.positionTransform, sizeof(level.positionTransform));
+        loaded.append(PackedMesh(streams[0], streams[1], streams[2], level.nVerts, level.nIndices,
+                                 (PackedMesh::PositionFormat)level.positionFormat, transform));
+    }
+
+    if (!valid) {
+        qWarning() << "MeshCache: ignoring stale or corrupt" << file->fileName();
+        delete file;
+        misses++;
+        return false;
+    }
+
+    meshes = loaded;
+    center = QVector3D(header.center[0], header.center[1], header.center[2]);
+    extent = QVector3D(header.extent[0], header.extent[1], header.extent[2]);
+    mappedFiles.append(file);
+    hits++;
+    return true;
+}
+
+bool MeshCache::store(const QString &key, const QVector<PackedMesh> &meshes, const QVector3D &center, const QVector3D &extent)
+{
+    QByteArray keyBytes = key.toUtf8();
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER;
+    header.keySize = keyBytes.size();
+    header.levelCount = meshes.size();
+    for (int c = 0; c < 3; c++) {
+        header.center[c] = center[c];
+        header.extent[c] = extent[c];
+    }
+
+    qint64 tableOffset = align16(sizeof(CacheHeader) + keyBytes.size());
+    qint64 offset = align16(tableOffset + meshes.size() * sizeof(CacheLevel));
+
+    QByteArray table(tableOffset + meshes.size() * sizeof(CacheLevel), 0);
+    for (int l = 0; l < meshes.size(); l++)
+    {
+        const PackedMesh &mesh = meshes[l];
+        const QByteArray *streams[3] = { &mesh.getPositions(), &mesh.getAttributes(), &mesh.getIndices() };
+
+        CacheLevel level;
+        memset(&level, 0, sizeof(level));
+        level.nVerts = mesh.getnVerts();
+        level.nIndices = mesh.getnIndices();
+        level.positionFormat = mesh.getPositionFormat();
+        memcpy(level.positionTransform, mesh.getPositionTransform().constData(), sizeof(level.positionTransform));
+        for (int s = 0; s < 3; s++) {
+            level.offset[s] = offset;
+            level.size[s] = streams[s]->size();
+            level.checksum[s] = checksum(streams[s]->constData(), streams[s]->size());
+            offset = align16(offset + streams[s]->size());
+        }
+        memcpy(table.data() + tableOffset + l * sizeof(CacheLevel), &level, sizeof(level));
+    }
+
+    memcpy(table.data(), &header, sizeof(header));
+    memcpy(table.data() + sizeof(CacheHeader), keyBytes.constData(), keyBytes.size());
+    header.tableChecksum = checksum(table.constData(), table.size());
+    memcpy(table.data(), &header, sizeof(header));
+
+    // Written under a temporary name and renamed, a reader never sees half
+    // a file
+    QSaveFile file(fileName(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "MeshCache: cannot write" << file.fileName();
+        return false;
+    }
+
+    QByteArray padding(16, 0);
+    file.write(table);
+    file.write(padding.constData(), align16(table.size()) - table.size());
+    for (int l = 0; l < meshes.size(); l++)
+    {
+        const PackedMesh &mesh = meshes[l];
+        const QByteArray *streams[3] = { &mesh.getPositions(), &mesh.getAttributes(), &mesh.getIndices() };
+        for (int s = 0; s < 3; s++) {
+            file.write(*streams[s]);
+            file.write(padding.constData(), align16(streams[s]->size()) - streams[s]->size());
+        }
+    }
+
+    return file.commit();
+}
+
+void MeshCache::clear()
+{
+    QDir dir(directory);
+    QStringList files = dir.entryList(QStringList("*.mesh"), QDir::Files);
+    for (int i = 0; i < files.size(); i++)
+        dir.remove(files[i]);
+}
+
+int MeshCache::getHits() const
+{
+    return hits;
+}
+
+int MeshCache::getMisses() const
+{
+    return misses;
+}
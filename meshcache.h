@@ -0,0 +1,51 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+#include <QList>
+#include <QFile>
+
+#include "packedmesh.h"
+
+// On-disk cache of packed LOD chains, keyed by a string naming the
+// generator and every parameter that shapes its output. One file per key:
+//
+//   header      magic, version, byte order, level count, bounds and a
+//               checksum of the header, key and level table
+//   key         the full key, so a hash collision is a miss
+//   level table counts, format, position transform, offset, size and
+//               checksum of the three streams of each level
+//   streams     positions, attributes and indices, 16 byte aligned
+//
+// A hit maps the file and the meshes point into the mapping, so the
+// streams go from the page cache to glBufferSubData without a copy. The
+// mappings stay valid as long as the cache object lives.
+class MeshCache
+{
+public:
+    explicit MeshCache(const QString &directory);
+    ~MeshCache();
+
+    // False on a miss, or when the file is from another version or fails
+    // its checksums
+    bool load(const QString &key, QVector<PackedMesh> &meshes, QVector3D &center, QVector3D &extent);
+    bool store(const QString &key, const QVector<PackedMesh> &meshes, const QVector3D &center, const QVector3D &extent);
+    void clear();
+
+    int getHits() const;
+    int getMisses() const;
+
+    // Fletcher style sums over 32-bit words, cheap enough to check every load
+    static quint64 checksum(const char *data, qint64 size);
+
+private:
+    QString directory;
+    QList<QFile *> mappedFiles;
+    int hits, misses;
+
+    QString fileName(const QString &key) const;
+};
+
+#endif // MESHCACHE_H
@@ -0,0 +1,220 @@
+#include "meshoptimizer.h"
+
+#include <QVector3D>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    struct Cluster {
+        int first, count;
+        float sortKey;
+    };
+}
+
+double MeshOptimizer::CacheStats::acmr() const
+{
+    return triangles > 0 ? (double)misses / triangles : 0.0;
+}
+
+double MeshOptimizer::CacheStats::atvr() const
+{
+    return vertices > 0 ? (double)misses / vertices : 0.0;
+}
+
+QVector<int> MeshOptimizer::optimizeVertexCache(unsigned int *indices, int nIndices, int nVerts, int cacheSize)
+{
+    int nTriangles = nIndices / 3;
+    QVector<int> clusters;
+
+    // Vertex to triangle adjacency, and the triangles left to emit per vertex
+    QVector<int> live(nVerts, 0);
+    for (int i = 0; i < nIndices; i++)
+        live[indices[i]]++;
+
+    QVector<int> adjacencyStart(nVerts + 1, 0);
+    for (int v = 0; v < nVerts; v++)
+        adjacencyStart[v + 1] = adjacencyStart[v] + live[v];
+
+    QVector<int> adjacency(nIndices);
+    QVector<int> fill = adjacencyStart;
+    for (int i = 0; i < nIndices; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    QVector<int> cacheTime(nVerts, 0);
+    QVector<bool> emitted(nTriangles, false);
+    QVector<unsigned int> deadEnd;
+    QVector<unsigned int> candidates;
+    QVector<unsigned int> out;
+    out.reserve(nIndices);
+
+    int time = cacheSize + 1;
+    int cursor = 0;
+    int fan = -1;
+    bool jumped = true;
+
+    while (true)
+    {
+        if (fan < 0) {
+            // Dead end: the most recently used vertex with triangles left,
+            // otherwise the next one in input order
+            while (!deadEnd.isEmpty() && fan < 0) {
+                unsigned int d = deadEnd.takeLast();
+                if (live[d] > 0)
+                    fan = d;
+            }
+            while (fan < 0 && cursor < nVerts) {
+                if (live[cursor] > 0)
+                    fan = cursor;
+                cursor++;
+            }
+            if (fan < 0)
+                break;
+            jumped = true;
+        }
+
+        if (jumped) {
+            clusters.append(out.size() / 3);
+            jumped = false;
+        }
+
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (int a = adjacencyStart[fan]; a < adjacencyStart[fan + 1]; a++)
+        {
+            int t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            for (int c = 0; c < 3; c++) {
+                unsigned int v = indices[3 * t + c];
+                out.append(v);
+                deadEnd.append(v);
+                candidates.append(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // Next fan: the candidate that will still be in the cache once its
+        // own triangles are emitted, the oldest such one first
+        int next = -1, best = -1;
+        for (int i = 0; i < candidates.size(); i++)
+        {
+            unsigned int v = candidates[i];
+            if (live[v] <= 0)
+                continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        fan = next;
+    }
+
+    memcpy(indices, out.constData(), out.size() * sizeof(unsigned int));
+
+    return clusters;
+}
+
+void MeshOptimizer::optimizeOverdraw(unsigned int *indices, int nIndices, const float *v, const QVector<int> &clusters)
+{
+    int nTriangles = nIndices / 3;
+
+    QVector3D meshCenter;
+    for (int i = 0; i < nIndices; i++)
+        meshCenter += QVector3D(v[3 * indices[i]], v[3 * indices[i] + 1], v[3 * indices[i] + 2]);
+    meshCenter /= qMax(1, nIndices);
+
+    QVector<Cluster> sorted;
+    for (int c = 0; c < clusters.size(); c++)
+    {
+        Cluster cluster;
+        cluster.first = clusters[c];
+        cluster.count = (c + 1 < clusters.size() ? clusters[c + 1] : nTriangles) - cluster.first;
+
+        // Area weighted normal and centroid of the cluster
+        QVector3D center, normal;
+        for (int t = cluster.first; t < cluster.first + cluster.count; t++)
+        {
+            QVector3D p[3];
+            for (int k = 0; k < 3; k++) {
+                const float *pos = v + 3 * indices[3 * t + k];
+                p[k] = QVector3D(pos[0], pos[1], pos[2]);
+            }
+            center += (p[0] + p[1] + p[2]) / 3.0f;
+            normal += QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+        }
+        center /= qMax(1, cluster.count);
+
+        // Clusters facing away from the center occlude the others
+        cluster.sortKey = QVector3D::dotProduct(center - meshCenter, normal.normalized());
+        sorted.append(cluster);
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+    QVector<unsigned int> out;
+    out.reserve(nIndices);
+    for (int c = 0; c < sorted.size(); c++)
+        for (int i = 3 * sorted[c].first; i < 3 * (sorted[c].first + sorted[c].count); i++)
+            out.append(indices[i]);
+
+    memcpy(indices, out.constData(), out.size() * sizeof(unsigned int));
+}
+
+void MeshOptimizer::optimize(unsigned int *indices, int nIndices, const float *v, int nVerts, bool overdraw, int cacheSize)
+{
+    QVector<int> clusters = optimizeVertexCache(indices, nIndices, nVerts, cacheSize);
+    if (overdraw)
+        optimizeOverdraw(indices, nIndices, v, clusters);
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::simulateCache(const unsigned int *indices, int nIndices, int nVerts, int cacheSize, CachePolicy policy)
+{
+    CacheStats stats;
+    stats.misses = 0;
+    stats.triangles = nIndices / 3;
+    stats.vertices = 0;
+
+    QVector<bool> referenced(nVerts, false);
+
+    // FIFO: a vertex is cached while fewer than cacheSize misses happened
+    // since it was loaded. LRU: most recently used first.
+    QVector<int> loadedAt(nVerts, -1);
+    QVector<unsigned int> lru;
+
+    for (int i = 0; i < nIndices; i++)
+    {
+        unsigned int v = indices[i];
+        if (!referenced[v]) {
+            referenced[v] = true;
+            stats.vertices++;
+        }
+
+        if (policy == FIFO) {
+            if (loadedAt[v] < 0 || stats.misses - loadedAt[v] >= cacheSize) {
+                loadedAt[v] = stats.misses;
+                stats.misses++;
+            }
+        } else {
+            int pos = lru.indexOf(v);
+            if (pos < 0) {
+                stats.misses++;
+                if (lru.size() == cacheSize)
+                    lru.removeLast();
+            } else {
+                lru.remove(pos);
+            }
+            lru.prepend(v);
+        }
+    }
+
+    return stats;
+}
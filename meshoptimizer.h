@@ -0,0 +1,43 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <QVector>
+
+// Triangle reordering for generated index buffers, run once when a mesh is
+// built, and a post-transform vertex cache simulator to measure it.
+//
+// optimizeVertexCache() is Tipsify (Sander, Nehab and Barczak, "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw"): it fans
+// around vertices while their triangles are still in the cache. The places
+// where it has to jump to a new area of the mesh split the output into
+// clusters, which optimizeOverdraw() then sorts so that the ones facing
+// away from the mesh center, likely occluders, are drawn first.
+class MeshOptimizer
+{
+public:
+    enum CachePolicy {
+        FIFO, LRU
+    };
+
+    struct CacheStats {
+        int misses;
+        int triangles;
+        int vertices;
+
+        // Average cache miss ratio, transformed vertices per triangle
+        double acmr() const;
+        // Average transformed vertex ratio, 1.0 is the optimum
+        double atvr() const;
+    };
+
+    // Returns the first triangle of every cluster
+    static QVector<int> optimizeVertexCache(unsigned int *indices, int nIndices, int nVerts, int cacheSize = 16);
+    static void optimizeOverdraw(unsigned int *indices, int nIndices, const float *v, const QVector<int> &clusters);
+
+    // Both passes, the overdraw one when asked for
+    static void optimize(unsigned int *indices, int nIndices, const float *v, int nVerts, bool overdraw, int cacheSize = 16);
+
+    static CacheStats simulateCache(const unsigned int *indices, int nIndices, int nVerts, int cacheSize, CachePolicy policy);
+};
+
+#endif // MESHOPTIMIZER_H
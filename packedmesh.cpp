@@ -0,0 +1,245 @@
+#include "packedmesh.h"
+
+#include <cmath>
+#include <cstring>
+
+static qint16 toSnorm16(float f)
+{
+    if (f > 1.0f) f = 1.0f;
+    if (f < -1.0f) f = -1.0f;
+    return (qint16)floorf(f * 32767.0f + 0.5f);
+}
+
+// IEEE half float, rounded to nearest
+static quint16 toHalf(float f)
+{
+    quint32 x;
+    memcpy(&x, &f, sizeof(x));
+
+    quint32 sign = (x >> 16) & 0x8000;
+    int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+    quint32 mantissa = x & 0x7fffff;
+
+    if (exponent <= 0) {
+        // Denormal or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        quint32 half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return sign | half;
+    }
+    if (exponent >= 31)
+        return sign | 0x7c00;
+
+    quint32 half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++;     // A carry into the exponent is still the right rounding
+    return half;
+}
+
+// Unit vector to the octahedron unfolded on the [-1,1] square, see
+// octDecode() in vshader.txt for the inverse
+static void octEncode(const float *n, qint16 *out)
+{
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 <= 0.0f) {
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    float x = n[0] / l1;
+    float y = n[1] / l1;
+    if (n[2] < 0.0f) {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+
+    out[0] = toSnorm16(x);
+    out[1] = toSnorm16(y);
+}
+
+PackedMesh::PackedMesh()
+    : nVerts(0), nIndices(0), positionFormat(FLOAT_POSITIONS), indexType(GL_UNSIGNED_INT)
+{
+}
+
+PackedMesh::PackedMesh(const float *v, const float *n, const float *tc, int nVerts,
+                       const unsigned int *el, int nIndices, PositionFormat format, const QMatrix4x4 *box)
+    : nVerts(nVerts), nIndices(nIndices), positionFormat(format),
+      indexType(nVerts < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT)
+{
+    packPositions(v, box);
+    packAttributes(n, tc);
+    packIndices(el);
+}
+
+PackedMesh::PackedMesh(const QByteArray &positions, const QByteArray &attributes, const QByteArray &indices,
+                       int nVerts, int nIndices, PositionFormat format, const QMatrix4x4 &positionTransform)
+    : positions(positions), attributes(attributes), indices(indices), nVerts(nVerts), nIndices(nIndices),
+      positionFormat(format), indexType(nVerts < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
+      positionTransform(positionTransform)
+{
+}
+
+void PackedMesh::packPositions(const float *v, const QMatrix4x4 *box)
+{
+    positionTransform.setToIdentity();
+
+    if (positionFormat == FLOAT_POSITIONS) {
+        positions = QByteArray((const char *)v, nVerts * 3 * sizeof(float));
+        return;
+    }
+
+    // Quantize in the bounding box, center and half extents become the
+    // position transform
+    if (box != 0) {
+        positionTransform = *box;
+    } else {
+        float lo[3] = { 0.0f, 0.0f, 0.0f }, hi[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < nVerts; i++)
+            for (int c = 0; c < 3; c++) {
+                if (i == 0 || v[3 * i + c] < lo[c]) lo[c] = v[3 * i + c];
+                if (i == 0 || v[3 * i + c] > hi[c]) hi[c] = v[3 * i + c];
+            }
+        positionTransform = boxTransform(QVector3D(lo[0], lo[1], lo[2]), QVector3D(hi[0], hi[1], hi[2]));
+    }
+
+    float center[3], halfExtent[3];
+    for (int c = 0; c < 3; c++) {
+        center[c] = positionTransform(c, 3);
+        halfExtent[c] = positionTransform(c, c);
+    }
+
+    positions.resize(nVerts * 4 * sizeof(qint16));
+    qint16 *out = (qint16 *)positions.data();
+    for (int i = 0; i < nVerts; i++) {
+        for (int c = 0; c < 3; c++)
+            out[4 * i + c] = toSnorm16((v[3 * i + c] - center[c]) / halfExtent[c]);
+        out[4 * i + 3] = 0;
+    }
+}
+
+QMatrix4x4 PackedMesh::boxTransform(const QVector3D &lo, const QVector3D &hi)
+{
+    QVector3D center = 0.5f * (lo + hi);
+    QVector3D halfExtent = 0.5f * (hi - lo);
+    for (int c = 0; c < 3; c++)
+        if (halfExtent[c] <= 0.0f)
+            halfExtent[c] = 1.0f;   // Flat axis, keep the transform invertible
+
+    QMatrix4x4 transform;
+    transform.translate(center);
+    transform.scale(halfExtent);
+    return transform;
+}
+
+void PackedMesh::packAttributes(const float *n, const float *tc)
+{
+    attributes.resize(nVerts * attributeStride());
+
+    char *out = attributes.data();
+    for (int i = 0; i < nVerts; i++) {
+        qint16 normal[2];
+        quint16 uv[2];
+        octEncode(n + 3 * i, normal);
+        uv[0] = tc != 0 ? toHalf(tc[2 * i])     : 0;
+        uv[1] = tc != 0 ? toHalf(tc[2 * i + 1]) : 0;
+
+        memcpy(out, normal, sizeof(normal));
+        memcpy(out + sizeof(normal), uv, sizeof(uv));
+        out += attributeStride();
+    }
+}
+
+void PackedMesh::packIndices(const unsigned int *el)
+{
+    if (indexType == GL_UNSIGNED_INT) {
+        indices = QByteArray((const char *)el, nIndices * sizeof(unsigned int));
+        return;
+    }
+
+    indices.resize(nIndices * sizeof(quint16));
+    quint16 *out = (quint16 *)indices.data();
+    for (int i = 0; i < nIndices; i++)
+        out[i] = (quint16)el[i];
+}
+
+const QByteArray &PackedMesh::getPositions() const
+{
+    return positions;
+}
+
+const QByteArray &PackedMesh::getAttributes() const
+{
+    return attributes;
+}
+
+const QByteArray &PackedMesh::getIndices() const
+{
+    return indices;
+}
+
+int PackedMesh::getnVerts() const
+{
+    return nVerts;
+}
+
+int PackedMesh::getnIndices() const
+{
+    return nIndices;
+}
+
+PackedMesh::PositionFormat PackedMesh::getPositionFormat() const
+{
+    return positionFormat;
+}
+
+GLenum PackedMesh::getIndexType() const
+{
+    return indexType;
+}
+
+const QMatrix4x4 &PackedMesh::getPositionTransform() const
+{
+    return positionTransform;
+}
+
+int PackedMesh::positionStride() const
+{
+    return positionFormat == QUANTIZED_POSITIONS ? 4 * sizeof(qint16) : 3 * sizeof(float);
+}
+
+int PackedMesh::attributeStride() const
+{
+    return 2 * sizeof(qint16) + 2 * sizeof(quint16);
+}
+
+int PackedMesh::indexSize() const
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(quint16) : sizeof(unsigned int);
+}
+
+int PackedMesh::bytesPerVertex() const
+{
+    return positionStride() + attributeStride();
+}
+
+int PackedMesh::totalBytes() const
+{
+    return positions.size() + attributes.size() + indices.size();
+}
+
+int PackedMesh::texCoordBytes() const
+{
+    return nVerts * 2 * sizeof(quint16);
+}
+
+int PackedMesh::unpackedBytes(int nVerts, int nIndices)
+{
+    return nVerts * (3 + 3) * sizeof(float) + nIndices * sizeof(unsigned int);
+}
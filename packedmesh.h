@@ -0,0 +1,78 @@
+#ifndef PACKEDMESH_H
+#define PACKEDMESH_H
+
+#include <QByteArray>
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QOpenGLFunctions>
+
+// GPU ready copy of a Teapot, Torus or VBOPlane mesh in two vertex streams:
+//
+//   positions   3 floats (12 bytes), or 4 normalized shorts (8 bytes) in
+//               the bounding box of the mesh when quantized
+//   attributes  interleaved octahedral normal (2 normalized shorts) and
+//               half float texture coordinates, 8 bytes
+//
+// Positions stay in their own stream so the shadow pass only fetches
+// them. Indices are 16 bit whenever the vertex count allows it.
+class PackedMesh
+{
+public:
+    enum PositionFormat {
+        FLOAT_POSITIONS, QUANTIZED_POSITIONS
+    };
+
+private:
+    QByteArray positions;
+    QByteArray attributes;
+    QByteArray indices;
+
+    int nVerts;
+    int nIndices;
+    PositionFormat positionFormat;
+    GLenum indexType;
+
+    // Maps quantized positions back to the mesh coordinates
+    QMatrix4x4 positionTransform;
+
+    void packPositions(const float *v, const QMatrix4x4 *box);
+    void packAttributes(const float *n, const float *tc);
+    void packIndices(const unsigned int *el);
+
+public:
+    PackedMesh();
+    // Quantized positions use the mesh's own bounding box unless box is
+    // given, as returned by boxTransform(), so that several meshes share it
+    PackedMesh(const float *v, const float *n, const float *tc, int nVerts,
+               const unsigned int *el, int nIndices, PositionFormat format, const QMatrix4x4 *box = 0);
+    // Already packed streams, e.g. QByteArray::fromRawData() on a mapped
+    // cache file, used as they are without a copy
+    PackedMesh(const QByteArray &positions, const QByteArray &attributes, const QByteArray &indices,
+               int nVerts, int nIndices, PositionFormat format, const QMatrix4x4 &positionTransform);
+
+    const QByteArray &getPositions() const;
+    const QByteArray &getAttributes() const;
+    const QByteArray &getIndices() const;
+
+    int    getnVerts() const;
+    int    getnIndices() const;
+    PositionFormat getPositionFormat() const;
+    GLenum getIndexType() const;
+    const QMatrix4x4 &getPositionTransform() const;
+
+    int positionStride() const;
+    int attributeStride() const;
+    int indexSize() const;
+    int bytesPerVertex() const;
+    int totalBytes() const;
+    // Of the attribute stream, the baseline meshes had no texture coordinates
+    int texCoordBytes() const;
+
+    // Size of the same mesh as the baseline uploaded it: float positions
+    // and normals in separate arrays, 32-bit indices
+    static int unpackedBytes(int nVerts, int nIndices);
+    // Maps [-1,1] on each axis to the box lo..hi
+    static QMatrix4x4 boxTransform(const QVector3D &lo, const QVector3D &hi);
+};
+
+#endif // PACKEDMESH_H
@@ -0,0 +1,132 @@
+#include "programcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+
+#include <cstring>
+
+static const char    PROGRAM_MAGIC[8] = { 'S', 'M', 'P', 'R', 'O', 'G', 0, 0 };
+static const quint32 PROGRAM_VERSION = 1;
+
+struct ProgramHeader
+{
+    char    magic[8];
+    quint32 version;
+    quint32 format;         // From glGetProgramBinary
+    quint32 size;
+    quint32 reserved;
+};
+
+ProgramCache::ProgramCache(QOpenGLFunctions_4_3_Core *funcs, const QString &directory)
+    : mFuncs(funcs), directory(directory), hits(0), misses(0), rejected(0), hitMs(0.0), compileMs(0.0)
+{
+    QDir().mkpath(directory);
+
+    driver = QByteArray((const char *)mFuncs->glGetString(GL_VENDOR)) + "\n"
+           + QByteArray((const char *)mFuncs->glGetString(GL_RENDERER)) + "\n"
+           + QByteArray((const char *)mFuncs->glGetString(GL_VERSION)) + "\n";
+
+    GLint formats = 0;
+    mFuncs->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0)
+        qWarning() << "ProgramCache: the driver offers no program binary formats, every program is compiled";
+}
+
+QByteArray ProgramCache::key(const QByteArray &sources) const
+{
+    return QCryptographicHash::hash(driver + sources, QCryptographicHash::Sha1).toHex();
+}
+
+QString ProgramCache::fileName(const QByteArray &key) const
+{
+    return directory + "/" + QString::fromLatin1(key) + ".bin";
+}
+
+bool ProgramCache::load(const QByteArray &key, GLuint program)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(fileName(key));
+    if (!file.open(QIODevice::ReadOnly)) {
+        misses++;
+        return false;
+    }
+    QByteArray data = file.readAll();
+
+    ProgramHeader header;
+    if (data.size() < (int)sizeof(header)) {
+        misses++;
+        return false;
+    }
+    memcpy(&header, data.constData(), sizeof(header));
+    if (memcmp(header.magic, PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC)) != 0 || header.version != PROGRAM_VERSION
+            || header.size != (quint32)data.size() - sizeof(header)) {
+        misses++;
+        return false;
+    }
+
+    mFuncs->glProgramBinary(program, header.format, data.constData() + sizeof(header), header.size);
+
+    GLint linked = GL_FALSE;
+    mFuncs->glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        qWarning() << "ProgramCache: driver rejected" << file.fileName();
+        rejected++;
+        misses++;
+        return false;
+    }
+
+    hits++;
+    hitMs += timer.nsecsElapsed() / 1.0e6;
+    return true;
+}
+
+void ProgramCache::prepare(GLuint program)
+{
+    mFuncs->glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+bool ProgramCache::store(const QByteArray &key, GLuint program)
+{
+    GLint length = 0;
+    mFuncs->glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    ProgramHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC));
+    header.version = PROGRAM_VERSION;
+
+    QByteArray binary(length, 0);
+    GLenum format = 0;
+    mFuncs->glGetProgramBinary(program, length, &length, &format, binary.data());
+    header.format = format;
+    header.size = length;
+
+    QSaveFile file(fileName(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "ProgramCache: cannot write" << file.fileName();
+        return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.constData(), length);
+
+    return file.commit();
+}
+
+void ProgramCache::addCompileTime(double ms)
+{
+    compileMs += ms;
+}
+
+void ProgramCache::printSummary() const
+{
+    printf("Program cache: %d hits in %.2f ms, %d compiled in %.2f ms, %d binaries rejected\n",
+           hits, hitMs, misses, compileMs, rejected);
+}
@@ -0,0 +1,41 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <QString>
+#include <QByteArray>
+
+#include <QOpenGLFunctions_4_3_Core>
+
+// Linked program binaries on disk, from glGetProgramBinary.
+//
+// The key hashes the full source of every stage together with GL_VENDOR,
+// GL_RENDERER and GL_VERSION, so a driver update or an edited shader is a
+// miss. A driver may still reject a binary it wrote itself; load() then
+// returns false and the caller builds from source again.
+class ProgramCache
+{
+public:
+    ProgramCache(QOpenGLFunctions_4_3_Core *funcs, const QString &directory);
+
+    QByteArray key(const QByteArray &sources) const;
+
+    // Loads the binary into program, true when the driver accepted it
+    bool load(const QByteArray &key, GLuint program);
+    // Call before linking from source, so the binary can be stored after
+    void prepare(GLuint program);
+    bool store(const QByteArray &key, GLuint program);
+
+    void addCompileTime(double ms);
+    void printSummary() const;
+
+private:
+    QOpenGLFunctions_4_3_Core *mFuncs;
+    QString    directory;
+    QByteArray driver;
+    int    hits, misses, rejected;
+    double hitMs, compileMs;
+
+    QString fileName(const QByteArray &key) const;
+};
+
+#endif // PROGRAMCACHE_H
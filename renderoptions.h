@@ -0,0 +1,63 @@
+#ifndef RENDEROPTIONS_H
+#define RENDEROPTIONS_H
+
+#include <QString>
+
+// Settings picked on the command line and handed to MyWindow at startup
+struct RenderOptions
+{
+    bool    perDrawGpuTiming;       // Time each object draw instead of whole passes
+    QString gpuStatsFile;           // Base name of the CSV/JSON GPU timing dump, empty = off
+    bool    depthOnlyShadowPass;    // Render the shadow map with the depth-only program
+    int     teapotGrid;             // Tessellation of each teapot patch
+    int     stressCount;            // Teapots and tori of the generated stress scene, 0 = default scene
+    bool    stressRandom;           // Scatter them randomly instead of on a grid
+    bool    optimizeIndices;        // Reorder triangles for the post-transform vertex cache
+    bool    overdrawOrder;          // Then sort triangle clusters front to back from the outside
+    bool    quantizePositions;      // Store positions as 16-bit integers in the mesh bounds
+    bool    shadowCache;            // Skip the shadow pass while nothing it depends on changed
+    int     shadowMapSize;          // Width and height of the shadow map (each cascade)
+    QString shadowFormat;           // Depth format of the shadow map: 16, 24 or 32f
+    QString pcfKernel;              // Shadow filter: none, 2x2, 3x3, 5x5, 7x7, 9x9 or poisson
+    QString shadowFilter;           // "pcf" on the depth map, or "vsm"/"esm" moments filtered by the hardware
+    int     shadowBlur;             // Radius in texels of the box blur of the moments
+    float   esmExponent;            // Sharpness of the exponential shadow map
+    int     cascades;               // Cascaded shadow map count, 0 = single perspective map
+    float   cascadeLambda;          // Split blend, 0 = uniform, 1 = logarithmic
+    float   cascadeFar;             // Distance covered by the last cascade
+    bool    perCascadeTiming;       // Render and time each cascade in its own pass
+    bool    frustumCulling;         // Skip objects outside the camera or light frustum
+    bool    gpuTessellation;        // Draw the teapots as Bezier patches tessellated on the GPU
+    float   tessPixelsPerEdge;      // Target screen size of a tessellated edge in the lit pass
+    float   tessShadowScale;        // Tessellation level of the shadow pass relative to the lit pass
+    bool    meshLod;                // Draw coarser levels of the meshes as they get smaller on screen
+    float   lodPixels;              // Projected size of the bounds below which the next level is used
+    float   shadowLodBias;          // Levels added in the shadow pass
+    float   lodHysteresis;          // Fraction of a level the size must pass a boundary by to switch
+    QString meshCacheDir;           // Directory of the packed mesh cache, empty = generate every run
+    bool    meshCacheClear;         // Empty the cache first, for a cold start
+    QString programCacheDir;        // Directory of linked program binaries, empty = compile every run
+    QString frameLoop;              // "vsync": update requests paced by the swap, "timer": the old tick timers
+    int     swapInterval;           // Frames per swap in either loop, 0 = unthrottled
+    bool    loopStats;              // Print wakeups and frame interval jitter every few seconds
+    int     streamRegions;          // Frames the per-frame stream buffer rotates through
+    bool    glStateCache;           // Skip binds and enables that would not change the GL state
+    QString captureFile;            // Frames are recorded here, empty = off
+    QString captureFormat;          // "raw" RGBA rows or "y4m"
+    int     captureRing;            // Readbacks in flight before frames are dropped
+    QString sweep;                  // Benchmark sweep to run in headless mode, empty = single run
+
+    RenderOptions()
+        : perDrawGpuTiming(false), depthOnlyShadowPass(true), teapotGrid(14), stressCount(0), stressRandom(false),
+          optimizeIndices(true), overdrawOrder(false), quantizePositions(true), shadowCache(true),
+          shadowMapSize(512), shadowFormat("24"), pcfKernel("none"), shadowFilter("pcf"), shadowBlur(2), esmExponent(40.0f),
+          cascades(0), cascadeLambda(0.75f), cascadeFar(40.0f), perCascadeTiming(false),
+          frustumCulling(true), gpuTessellation(false), tessPixelsPerEdge(8.0f), tessShadowScale(0.5f),
+          meshLod(false), lodPixels(256.0f), shadowLodBias(1.0f), lodHysteresis(0.2f),
+          meshCacheClear(false), frameLoop("vsync"), swapInterval(1), loopStats(false),
+          streamRegions(3), glStateCache(true), captureFormat("raw"), captureRing(3)
+    {
+    }
+};
+
+#endif // RENDEROPTIONS_H
@@ -0,0 +1,135 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+
+static const int DEPTH_SHIFT    = 0;
+static const int MATERIAL_SHIFT = DEPTH_SHIFT + RenderQueue::DEPTH_BITS;
+static const int MESH_SHIFT     = MATERIAL_SHIFT + RenderQueue::MATERIAL_BITS;
+static const int VAO_SHIFT      = MESH_SHIFT + RenderQueue::MESH_BITS;
+static const int PROGRAM_SHIFT  = VAO_SHIFT + RenderQueue::VAO_BITS;
+
+static quint64 field(int value, int bits, int shift)
+{
+    return ((quint64)value & ((1ull << bits) - 1)) << shift;
+}
+
+static bool keyLess(const RenderQueue::Packet &a, const RenderQueue::Packet &b)
+{
+    return a.key < b.key;
+}
+
+quint64 RenderQueue::makeKey(int program, int vao, int mesh, int material, float depth)
+{
+    const quint32 maxDepth = (1u << DEPTH_BITS) - 1;
+    quint32 d = (quint32)(qBound(0.0f, depth, 1.0f) * maxDepth);
+
+    return field(program, PROGRAM_BITS, PROGRAM_SHIFT) | field(vao, VAO_BITS, VAO_SHIFT)
+         | field(mesh, MESH_BITS, MESH_SHIFT) | field(material, MATERIAL_BITS, MATERIAL_SHIFT)
+         | field(d, DEPTH_BITS, DEPTH_SHIFT);
+}
+
+int RenderQueue::keyProgram(quint64 key)
+{
+    return (int)(key >> PROGRAM_SHIFT) & ((1 << PROGRAM_BITS) - 1);
+}
+
+int RenderQueue::keyVao(quint64 key)
+{
+    return (int)(key >> VAO_SHIFT) & ((1 << VAO_BITS) - 1);
+}
+
+int RenderQueue::keyMesh(quint64 key)
+{
+    return (int)(key >> MESH_SHIFT) & ((1 << MESH_BITS) - 1);
+}
+
+RenderQueue::RenderQueue()
+    : switches(0)
+{
+}
+
+void RenderQueue::clear()
+{
+    packets.clear();
+    indices.clear();
+    cmds.clear();
+    runs.clear();
+    switches = 0;
+}
+
+void RenderQueue::submit(quint64 key, GLuint object)
+{
+    Packet packet = { key, object };
+    packets.append(packet);
+}
+
+void RenderQueue::build(const QVector<MeshRange> &meshes)
+{
+    std::sort(packets.begin(), packets.end(), keyLess);
+
+    indices.resize(packets.size());
+    cmds.clear();
+    runs.clear();
+    switches = 0;
+
+    // Everything above the material decides the command
+    const quint64 commandMask = ~0ull << MESH_SHIFT;
+    const quint64 batchMask = ~0ull << VAO_SHIFT;
+
+    for (int i = 0; i < packets.size(); i++)
+    {
+        quint64 key = packets[i].key;
+        indices[i] = packets[i].object;
+
+        if (i > 0 && (key & commandMask) == (packets[i - 1].key & commandMask)) {
+            cmds.last().instanceCount++;
+            continue;
+        }
+
+        const MeshRange &mesh = meshes[keyMesh(key)];
+        DrawElementsIndirectCommand cmd;
+        cmd.count = mesh.indexCount;
+        cmd.instanceCount = 1;
+        cmd.firstIndex = mesh.firstIndex;
+        cmd.baseVertex = mesh.baseVertex;
+        cmd.baseInstance = i;
+        cmds.append(cmd);
+
+        if (i > 0 && (key & batchMask) == (packets[i - 1].key & batchMask)) {
+            runs.last().commands++;
+            continue;
+        }
+
+        Batch batch = { keyProgram(key), keyVao(key), cmds.size() - 1, 1 };
+        if (runs.isEmpty() || runs.last().program != batch.program)
+            switches++;
+        if (runs.isEmpty() || runs.last().vao != batch.vao)
+            switches++;
+        runs.append(batch);
+    }
+}
+
+const QVector<GLuint> &RenderQueue::drawIndices() const
+{
+    return indices;
+}
+
+const QVector<DrawElementsIndirectCommand> &RenderQueue::commands() const
+{
+    return cmds;
+}
+
+const QVector<RenderQueue::Batch> &RenderQueue::batches() const
+{
+    return runs;
+}
+
+int RenderQueue::getPackets() const
+{
+    return packets.size();
+}
+
+int RenderQueue::getSwitches() const
+{
+    return switches;
+}
@@ -0,0 +1,72 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <QVector>
+
+#include "geometryarena.h"
+
+// Draws of one pass, submitted as packets and replayed in key order.
+//
+// A key packs, from the most significant bits down, the program, the VAO,
+// the mesh, the material and the depth of a packet, so sorting puts the
+// draws that share state next to each other. Depth only decides between
+// packets that agree on everything above it: the instances of one mesh
+// and material are drawn front to back, the pass as a whole is not.
+// build() turns every run of packets with the same
+// program, VAO and mesh into one instanced indirect command, and every run
+// of commands with the same program and VAO into a batch: the only places
+// where state changes when the queue is replayed.
+class RenderQueue
+{
+public:
+    struct Packet {
+        quint64 key;
+        GLuint  object;         // Index of the object's data in the storage buffer
+    };
+
+    struct Batch {
+        int program, vao;
+        int firstCommand, commands;
+    };
+
+    enum {
+        PROGRAM_BITS  = 4,
+        VAO_BITS      = 4,
+        MESH_BITS     = 16,
+        MATERIAL_BITS = 16,
+        DEPTH_BITS    = 24
+    };
+
+    // depth is 0 at the near plane and 1 at the far one, clamped
+    static quint64 makeKey(int program, int vao, int mesh, int material, float depth);
+    static int     keyProgram(quint64 key);
+    static int     keyVao(quint64 key);
+    static int     keyMesh(quint64 key);
+
+    RenderQueue();
+
+    void clear();
+    void submit(quint64 key, GLuint object);
+
+    // Sorts the packets and builds the draw index list, the commands and
+    // the batches. Mesh numbers in the keys index meshes.
+    void build(const QVector<MeshRange> &meshes);
+
+    // Objects in key order, what baseInstance of the commands points into
+    const QVector<GLuint>                      &drawIndices() const;
+    const QVector<DrawElementsIndirectCommand> &commands() const;
+    const QVector<Batch>                       &batches() const;
+
+    int getPackets() const;
+    // Program or VAO changes between batches, the first bind included
+    int getSwitches() const;
+
+private:
+    QVector<Packet> packets;
+    QVector<GLuint> indices;
+    QVector<DrawElementsIndirectCommand> cmds;
+    QVector<Batch>  runs;
+    int switches;
+};
+
+#endif // RENDERQUEUE_H
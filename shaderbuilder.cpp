@@ -0,0 +1,124 @@
+#include "shaderbuilder.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QElapsedTimer>
+
+#include "programcache.h"
+
+ShaderBuilder &ShaderBuilder::addStage(QOpenGLShader::ShaderType type, const QString &fileName)
+{
+    Stage stage;
+    stage.type = type;
+    stage.fileName = fileName;
+    stages.append(stage);
+
+    return *this;
+}
+
+ShaderBuilder &ShaderBuilder::define(const QByteArray &name, const QByteArray &value)
+{
+    defines += "#define " + name + " " + value + "\n";
+
+    return *this;
+}
+
+ShaderBuilder &ShaderBuilder::define(const QByteArray &name, int value)
+{
+    return define(name, QByteArray::number(value));
+}
+
+QByteArray ShaderBuilder::loadSource(const QString &fileName)
+{
+    QFile      shaderFile(fileName);
+    QByteArray shaderSource;
+
+    if (!shaderFile.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open shader" << fileName;
+        return shaderSource;
+    }
+    shaderSource = shaderFile.readAll();
+    shaderFile.close();
+
+    // Resolve #include "file" lines, relative to the resource root
+    int pos = 0;
+    while ((pos = shaderSource.indexOf("#include \"", pos)) >= 0)
+    {
+        int nameStart = pos + 10;
+        int nameEnd = shaderSource.indexOf('"', nameStart);
+        int lineEnd = shaderSource.indexOf('\n', nameEnd);
+        if (nameEnd < 0)
+            break;
+        if (lineEnd < 0)
+            lineEnd = shaderSource.size();
+
+        QByteArray included = loadSource(":/" + QString::fromLatin1(shaderSource.mid(nameStart, nameEnd - nameStart)));
+        shaderSource = shaderSource.left(pos) + included + shaderSource.mid(lineEnd);
+        pos += included.size();
+    }
+
+    return shaderSource;
+}
+
+// Full source of a stage, with the defines injected after #version
+QByteArray ShaderBuilder::source(int stage) const
+{
+    QByteArray shaderSource = loadSource(stages[stage].fileName);
+
+    if (!defines.isEmpty()) {
+        int version = shaderSource.indexOf("#version");
+        int lineEnd = version < 0 ? -1 : shaderSource.indexOf('\n', version);
+        shaderSource.insert(lineEnd + 1, defines);
+    }
+
+    return shaderSource;
+}
+
+QOpenGLShaderProgram *ShaderBuilder::link(const char *label, ProgramCache *cache) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<QByteArray> sources;
+    QByteArray allSources;
+    for (int i = 0; i < stages.size(); i++) {
+        sources.append(source(i));
+        allSources += QByteArray::number((int)stages[i].type) + "\n" + sources[i];
+    }
+
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+    QByteArray key;
+    if (cache != 0) {
+        // Without shaders, link() only checks the status glProgramBinary left
+        key = cache->key(allSources);
+        program->create();
+        if (cache->load(key, program->programId()) && program->link()) {
+            qDebug() << label << "from program cache:" << timer.nsecsElapsed() / 1.0e6 << "ms";
+            return program;
+        }
+
+        // A rejected binary may leave the program in any state
+        delete program;
+        program = new QOpenGLShaderProgram;
+        program->create();
+        cache->prepare(program->programId());
+    }
+
+    for (int i = 0; i < stages.size(); i++)
+    {
+        bool compiled = program->addShaderFromSourceCode(stages[i].type, sources[i]);
+        qDebug() << label << stages[i].fileName << "compile: " << compiled;
+    }
+
+    bool linked = program->link();
+    double ms = timer.nsecsElapsed() / 1.0e6;
+    qDebug() << label << "link: " << linked << ms << "ms";
+
+    if (cache != 0) {
+        cache->addCompileTime(ms);
+        if (linked)
+            cache->store(key, program->programId());
+    }
+
+    return program;
+}
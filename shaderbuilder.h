@@ -0,0 +1,42 @@
+#ifndef SHADERBUILDER_H
+#define SHADERBUILDER_H
+
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+
+#include <QOpenGLShader>
+#include <QOpenGLShaderProgram>
+
+class ProgramCache;
+
+// Compiles and links a program from shader files in the resources.
+//
+// Sources may pull in other resource files with #include "file" lines, and
+// every #define added with define() is injected right after the #version
+// line, so one source can be built into several specialized variants.
+// With a ProgramCache, link() tries the stored binary of the same sources
+// first and stores the binary of anything it had to compile.
+class ShaderBuilder
+{
+private:
+    struct Stage {
+        QOpenGLShader::ShaderType type;
+        QString fileName;
+    };
+
+    QVector<Stage> stages;
+    QByteArray     defines;
+
+public:
+    ShaderBuilder &addStage(QOpenGLShader::ShaderType type, const QString &fileName);
+    ShaderBuilder &define(const QByteArray &name, const QByteArray &value = "1");
+    ShaderBuilder &define(const QByteArray &name, int value);
+
+    QByteArray source(int stage) const;
+    QOpenGLShaderProgram *link(const char *label, ProgramCache *cache = 0) const;
+
+    static QByteArray loadSource(const QString &fileName);
+};
+
+#endif // SHADERBUILDER_H
@@ -0,0 +1,231 @@
+#include "shadowmaptarget.h"
+
+#include <cmath>
+
+static GLenum depthInternalFormat(ShadowMapTarget::DepthFormat format)
+{
+    switch (format)
+    {
+        case ShadowMapTarget::DEPTH16:  return GL_DEPTH_COMPONENT16;
+        case ShadowMapTarget::DEPTH32F: return GL_DEPTH_COMPONENT32F;
+        default:                        return GL_DEPTH_COMPONENT24;
+    }
+}
+
+// 24-bit depth is padded to 32 bits by the drivers we know of
+static int depthTexelBytes(ShadowMapTarget::DepthFormat format)
+{
+    return format == ShadowMapTarget::DEPTH16 ? 2 : 4;
+}
+
+ShadowMapTarget::Config::Config()
+    : width(512), height(512), layers(0), depth(DEPTH24), linearFilter(true), moments(NO_MOMENTS),
+      esmExponent(40.0f)
+{
+}
+
+bool ShadowMapTarget::Config::operator==(const Config &other) const
+{
+    // The exponent only matters to the border of ESM moments
+    return width == other.width && height == other.height && layers == other.layers && depth == other.depth
+        && linearFilter == other.linearFilter && moments == other.moments
+        && (moments != ESM_MOMENTS || esmExponent == other.esmExponent);
+}
+
+ShadowMapTarget::ShadowMapTarget(GlCoreFunctions *funcs)
+    : mFuncs(funcs), allocated(false), complete(false), framebuffer(0), depthTex(0), momentsTex(0), blurTex(0),
+      momentsLevels(0), allocations(0)
+{
+}
+
+ShadowMapTarget::~ShadowMapTarget()
+{
+    release();
+}
+
+bool ShadowMapTarget::configure(const Config &requested)
+{
+    if (allocated && requested == config)
+        return false;
+
+    release();
+    config = requested;
+    allocate();
+    return true;
+}
+
+void ShadowMapTarget::release()
+{
+    if (depthTex != 0) mFuncs->glDeleteTextures(1, &depthTex);
+    if (momentsTex != 0) mFuncs->glDeleteTextures(1, &momentsTex);
+    if (blurTex != 0) mFuncs->glDeleteTextures(1, &blurTex);
+    if (framebuffer != 0) mFuncs->glDeleteFramebuffers(1, &framebuffer);
+    depthTex = momentsTex = blurTex = framebuffer = 0;
+    momentsLevels = 0;
+    allocated = complete = false;
+}
+
+void ShadowMapTarget::allocate()
+{
+    GLenum target = getDepthTarget();
+    GLenum format = depthInternalFormat(config.depth);
+
+    GLfloat border[] = {1.0f, 0.0f,0.0f,0.0f };
+    // The depth buffer texture
+    mFuncs->glGenTextures(1, &depthTex);
+    mFuncs->glBindTexture(target, depthTex);
+    if (config.layers > 0)
+        mFuncs->glTexStorage3D(target, 1, format, config.width, config.height, config.layers);
+    else
+        mFuncs->glTexStorage2D(target, 1, format, config.width, config.height);
+    // Linear filtering makes every compare a bilinear 2x2 PCF tap
+    GLint filter = config.linearFilter ? GL_LINEAR : GL_NEAREST;
+    mFuncs->glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+    mFuncs->glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+    mFuncs->glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    mFuncs->glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    mFuncs->glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, border);
+    mFuncs->glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    mFuncs->glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
+
+    // VSM and ESM render moments into a float color target next to the
+    // depth buffer. It is sampled with trilinear filtering, so the blur
+    // fills a full mip chain.
+    if (config.moments != NO_MOMENTS) {
+        momentsLevels = 1;
+        while ((qMax(config.width, config.height) >> momentsLevels) > 0)
+            momentsLevels++;
+
+        // Outside the map is lit, as with the depth border above
+        GLfloat esmLit = exp(config.esmExponent);
+        GLfloat momentsBorder[] = { config.moments == VSM_MOMENTS ? 1.0f : esmLit, 1.0f, 0.0f, 0.0f };
+        mFuncs->glGenTextures(1, &momentsTex);
+        mFuncs->glBindTexture(GL_TEXTURE_2D, momentsTex);
+        mFuncs->glTexStorage2D(GL_TEXTURE_2D, momentsLevels, getMomentsFormat(), config.width, config.height);
+        mFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        mFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        mFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        mFuncs->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        mFuncs->glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, momentsBorder);
+
+        // The row pass of the blur writes here, the column pass back
+        mFuncs->glGenTextures(1, &blurTex);
+        mFuncs->glBindTexture(GL_TEXTURE_2D, blurTex);
+        mFuncs->glTexStorage2D(GL_TEXTURE_2D, 1, getMomentsFormat(), config.width, config.height);
+    }
+
+    // Create and set up the FBO, layered when the texture is an array
+    mFuncs->glGenFramebuffers(1, &framebuffer);
+    mFuncs->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    mFuncs->glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0);
+
+    if (momentsTex != 0) {
+        mFuncs->glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsTex, 0);
+        GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
+        mFuncs->glDrawBuffers(1, drawBuffers);
+    } else {
+        GLenum drawBuffers[] = {GL_NONE};
+        mFuncs->glDrawBuffers(1, drawBuffers);
+    }
+
+    complete = mFuncs->glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    mFuncs->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    allocated = true;
+    allocations++;
+}
+
+const ShadowMapTarget::Config &ShadowMapTarget::getConfig() const
+{
+    return config;
+}
+
+GLuint ShadowMapTarget::getFramebuffer() const
+{
+    return framebuffer;
+}
+
+GLuint ShadowMapTarget::getDepthTexture() const
+{
+    return depthTex;
+}
+
+GLenum ShadowMapTarget::getDepthTarget() const
+{
+    // Cascades live in the layers of a texture array
+    return config.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
+GLuint ShadowMapTarget::getMomentsTexture() const
+{
+    return momentsTex;
+}
+
+GLuint ShadowMapTarget::getBlurTexture() const
+{
+    return blurTex;
+}
+
+GLenum ShadowMapTarget::getMomentsFormat() const
+{
+    return config.moments == VSM_MOMENTS ? GL_RG32F : GL_R32F;
+}
+
+GLuint ShadowMapTarget::getSampledTexture() const
+{
+    return momentsTex != 0 ? momentsTex : depthTex;
+}
+
+GLenum ShadowMapTarget::getSampledTarget() const
+{
+    return momentsTex != 0 ? GL_TEXTURE_2D : getDepthTarget();
+}
+
+bool ShadowMapTarget::isComplete() const
+{
+    return complete;
+}
+
+qint64 ShadowMapTarget::getBytes() const
+{
+    if (!allocated)
+        return 0;
+
+    qint64 texels = (qint64)config.width * config.height;
+    qint64 bytes = texels * qMax(1, config.layers) * depthTexelBytes(config.depth);
+    if (momentsTex != 0) {
+        int texelBytes = config.moments == VSM_MOMENTS ? 8 : 4;
+        for (int level = 0; level < momentsLevels; level++)
+            bytes += (qint64)qMax(1, config.width >> level) * qMax(1, config.height >> level) * texelBytes;
+        bytes += texels * texelBytes;       // Blur intermediate
+    }
+    return bytes;
+}
+
+int ShadowMapTarget::getAllocations() const
+{
+    return allocations;
+}
+
+bool ShadowMapTarget::parseDepthFormat(const QString &name, DepthFormat &format)
+{
+    if (name == "16")
+        format = DEPTH16;
+    else if (name == "24")
+        format = DEPTH24;
+    else if (name == "32f")
+        format = DEPTH32F;
+    else
+        return false;
+    return true;
+}
+
+const char *ShadowMapTarget::depthFormatName(DepthFormat format)
+{
+    switch (format)
+    {
+        case DEPTH16:  return "16";
+        case DEPTH32F: return "32f";
+        default:       return "24";
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef SHADOWMAPTARGET_H
+#define SHADOWMAPTARGET_H
+
+#include <QString>
+#include "glcallstats.h"
+
+// The render target of the shadow pass: a depth texture, 2D or a 2D array
+// with a layer per cascade, optionally the float color target of the
+// VSM/ESM moments with the intermediate of their blur, and the
+// framebuffer they are attached to.
+//
+// configure() compares the requested configuration with the current one
+// and, when they differ, frees everything and allocates it anew, so the
+// resolution and formats can change between any two frames.
+class ShadowMapTarget
+{
+public:
+    enum DepthFormat { DEPTH16, DEPTH24, DEPTH32F };
+    enum Moments { NO_MOMENTS, VSM_MOMENTS, ESM_MOMENTS };
+
+    struct Config {
+        int         width, height;
+        int         layers;             // 0 for a 2D texture, else the layers of a 2D array
+        DepthFormat depth;
+        bool        linearFilter;       // Bilinear 2x2 compares, nearest otherwise
+        Moments     moments;
+        float       esmExponent;        // Sets the lit border of ESM moments
+
+        Config();
+        bool operator==(const Config &other) const;
+        bool operator!=(const Config &other) const { return !(*this == other); }
+    };
+
+    explicit ShadowMapTarget(GlCoreFunctions *funcs);
+    ~ShadowMapTarget();
+
+    // Reallocates when config differs from the current configuration,
+    // returns false when nothing had to change
+    bool configure(const Config &config);
+    void release();
+
+    const Config &getConfig() const;
+    GLuint getFramebuffer() const;
+    GLuint getDepthTexture() const;
+    GLenum getDepthTarget() const;
+    GLuint getMomentsTexture() const;   // 0 without moments
+    GLuint getBlurTexture() const;
+    GLenum getMomentsFormat() const;
+    // What the lit pass samples, the moments when there are any
+    GLuint getSampledTexture() const;
+    GLenum getSampledTarget() const;
+    bool   isComplete() const;
+
+    // Estimated video memory of the textures, mip chains included
+    qint64 getBytes() const;
+    int    getAllocations() const;
+
+    // "16", "24" or "32f"
+    static bool        parseDepthFormat(const QString &name, DepthFormat &format);
+    static const char *depthFormatName(DepthFormat format);
+
+private:
+    GlCoreFunctions *mFuncs;
+
+    Config config;
+    bool   allocated;
+    bool   complete;
+    GLuint framebuffer, depthTex, momentsTex, blurTex;
+    int    momentsLevels;
+    int    allocations;
+
+    void allocate();
+};
+
+#endif // SHADOWMAPTARGET_H
@@ -0,0 +1,142 @@
+#include "streambuffer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <cstring>
+
+StreamBuffer::StreamBuffer(GlCoreFunctions *funcs, int regions)
+    : mFuncs(funcs), buffer(0), regionSize(0), region(0), head(0),
+      stalls(0), overflows(0), stallNs(0)
+{
+    fences.fill(0, qMax(1, regions));
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    for (int i = 0; i < fences.size(); i++)
+        if (fences[i] != 0)
+            mFuncs->glDeleteSync(fences[i]);
+    mFuncs->glDeleteBuffers(1, &buffer);
+}
+
+// Waits until the GPU is done with a region. A fence that has already
+// signaled costs one non-blocking query, anything else is a stall.
+void StreamBuffer::waitForFence(int index)
+{
+    GLsync fence = fences[index];
+    if (fence == 0)
+        return;
+
+    GLenum status = mFuncs->glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        QElapsedTimer timer;
+        timer.start();
+        do {
+            status = mFuncs->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        stalls++;
+        stallNs += timer.nsecsElapsed();
+    }
+    if (status == GL_WAIT_FAILED)
+        qWarning() << "StreamBuffer: glClientWaitSync failed";
+
+    mFuncs->glDeleteSync(fence);
+    fences[index] = 0;
+}
+
+void StreamBuffer::reserve(GLsizeiptr bytesPerFrame)
+{
+    // Regions start on a boundary every alignment in use divides
+    bytesPerFrame = (bytesPerFrame + 255) & ~(GLsizeiptr)255;
+    if (bytesPerFrame <= regionSize)
+        return;
+
+    for (int i = 0; i < fences.size(); i++)
+        waitForFence(i);
+
+    if (buffer == 0)
+        mFuncs->glGenBuffers(1, &buffer);
+    mFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    mFuncs->glBufferData(GL_COPY_WRITE_BUFFER, bytesPerFrame * fences.size(), NULL, GL_STREAM_DRAW);
+    mFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    regionSize = bytesPerFrame;
+    region = 0;
+    head = 0;
+}
+
+void StreamBuffer::beginFrame()
+{
+    region = (region + 1) % fences.size();
+    head = 0;
+    waitForFence(region);
+}
+
+void StreamBuffer::endFrame()
+{
+    fences[region] = mFuncs->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+GLintptr StreamBuffer::write(const void *data, GLsizeiptr size, GLint align)
+{
+    GLintptr start = (head + align - 1) / align * align;
+    if (start + size > regionSize) {
+        if (overflows++ == 0)
+            qWarning() << "StreamBuffer: region of" << regionSize << "bytes is full";
+        return -1;
+    }
+
+    GLintptr offset = region * regionSize + start;
+    head = start + size;
+    if (size == 0)
+        return offset;
+
+    // Fenced above, so the range can be written without any driver sync
+    mFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    void *dst = mFuncs->glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                         GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (dst != 0) {
+        memcpy(dst, data, size);
+        mFuncs->glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    mFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    return offset;
+}
+
+GLuint StreamBuffer::getBuffer() const
+{
+    return buffer;
+}
+
+GLsizeiptr StreamBuffer::getRegionSize() const
+{
+    return regionSize;
+}
+
+int StreamBuffer::getRegions() const
+{
+    return fences.size();
+}
+
+int StreamBuffer::getStalls() const
+{
+    return stalls;
+}
+
+double StreamBuffer::getStallMs() const
+{
+    return stallNs / 1.0e6;
+}
+
+int StreamBuffer::getOverflows() const
+{
+    return overflows;
+}
+
+void StreamBuffer::resetStats()
+{
+    stalls = overflows = 0;
+    stallNs = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <QVector>
+#include "glcallstats.h"
+
+// One buffer split into a ring of frame sized regions for data written
+// every frame: the frame uniform blocks, the draw index lists and the
+// indirect commands.
+//
+// Writes go through glMapBufferRange with GL_MAP_UNSYNCHRONIZED_BIT, so the
+// driver never syncs or copies. Instead each region is fenced at the end
+// of its frame, and beginFrame() waits on the fence of the region it is
+// about to reuse. With three regions that only happens when the GPU is
+// more than two frames behind; each such wait counts as a stall.
+class StreamBuffer
+{
+private:
+    GlCoreFunctions *mFuncs;
+
+    GLuint buffer;
+    QVector<GLsync> fences;
+    GLsizeiptr regionSize;
+    int    region;
+    GLintptr head;          // Next free byte of the current region
+
+    int    stalls, overflows;
+    qint64 stallNs;
+
+    void waitForFence(int index);
+
+public:
+    StreamBuffer(GlCoreFunctions *funcs, int regions = 3);
+    ~StreamBuffer();
+
+    // Regions of at least bytesPerFrame, reallocated between frames
+    void reserve(GLsizeiptr bytesPerFrame);
+
+    void beginFrame();
+    void endFrame();
+
+    // Copies data to the current region and returns its offset in the
+    // buffer, aligned to align bytes. -1 when the region is full.
+    GLintptr write(const void *data, GLsizeiptr size, GLint align);
+
+    GLuint     getBuffer() const;
+    GLsizeiptr getRegionSize() const;
+    int        getRegions() const;
+
+    int    getStalls() const;
+    double getStallMs() const;
+    int    getOverflows() const;
+    void   resetStats();
+};
+
+#endif // STREAMBUFFER_H
@@ -2,10 +2,17 @@
 #include "teapotdata.h"
 
 #include <cstdio>
+#include <cmath>
 
 #include <QVector4D>
+#include <QtConcurrent>
 #include <qmath.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TEAPOT_SSE
+#endif
+
 Teapot::~Teapot()
 {
     delete[] v;
@@ -14,7 +21,7 @@ Teapot::~Teapot()
     delete[] tc;
 }
 
-Teapot::Teapot(int grid, const QMatrix4x4 & lidTransform)
+Teapot::Teapot(int grid, const QMatrix4x4 & lidTransform, bool parallel)
 {
     nVerts = 32 * (grid + 1) * (grid + 1);
     nFaces = grid * grid * 32;
@@ -23,40 +30,97 @@ Teapot::Teapot(int grid, const QMatrix4x4 & lidTransform)
     tc = new float[ nVerts * 2 ];
     elems = new unsigned int[nFaces * 6];
 
-    generatePatches( v, n, tc, elems, grid );
+    generatePatches( v, n, tc, elems, grid, parallel );
     moveLid(grid, v, lidTransform);
 }
 
-void Teapot::generatePatches(float * in_v, float * in_n, float * in_tc, unsigned int* in_el, int grid) {
-    float * B = new float[4*(grid+1)];  // Pre-computed Bernstein basis functions
-    float * dB = new float[4*(grid+1)]; // Pre-computed derivitives of basis functions
+// The rim, body, lid and bottom are mirrored into all four quadrants, the
+// handle and spout only in y. Reflected copies reverse v so the winding
+// stays the same, the normal is flipped when exactly one axis is mirrored.
+QVector<Teapot::PatchInstance> Teapot::patchInstances()
+{
+    QVector<PatchInstance> instances;
+    for( int patchNum = 0; patchNum < 10; patchNum++ )
+    {
+        bool reflectX = patchNum < 6;
+
+        PatchInstance plain = { patchNum, false, 1.0f, 1.0f, true };
+        instances.append(plain);
+        if( reflectX ) {
+            PatchInstance x = { patchNum, true, -1.0f, 1.0f, false };
+            instances.append(x);
+        }
+        PatchInstance y = { patchNum, true, 1.0f, -1.0f, false };
+        instances.append(y);
+        if( reflectX ) {
+            PatchInstance xy = { patchNum, false, -1.0f, -1.0f, true };
+            instances.append(xy);
+        }
+    }
+    return instances;
+}
 
-    int idx = 0, elIndex = 0, tcIndex = 0;
+void Teapot::generatePatches(float * in_v, float * in_n, float * in_tc, unsigned int* in_el, int grid, bool parallel) {
+    QVector<float> B(4*(grid+1));   // Pre-computed Bernstein basis functions
+    QVector<float> dB(4*(grid+1));  // Pre-computed derivitives of basis functions
 
     // Pre-compute the basis functions  (Bernstein polynomials)
     // and their derivatives
-    computeBasisFunctions(B, dB, grid);
-
-    // Build each patch
-    // The rim
-    buildPatchReflect(0, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The body
-    buildPatchReflect(1, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(2, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The lid
-    buildPatchReflect(3, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(4, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The bottom
-    buildPatchReflect(5, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, true, true);
-    // The handle
-    buildPatchReflect(6, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(7, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    // The spout
-    buildPatchReflect(8, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(9, B, dB, in_v, in_n, in_tc, in_el, idx, elIndex, tcIndex, grid, false, true);
-
-    delete [] B;
-    delete [] dB;
+    computeBasisFunctions(B.data(), dB.data(), grid);
+
+    // Along v the kernel reads four neighbouring samples of each basis
+    // function, so those are also stored one function after the other
+    QVector<float> Bv(4*(grid+1)), dBv(4*(grid+1));
+    for( int j = 0; j <= grid; j++ )
+        for( int k = 0; k < 4; k++ ) {
+            Bv[k*(grid+1) + j] = B[j*4 + k];
+            dBv[k*(grid+1) + j] = dB[j*4 + k];
+        }
+
+    // Every patch has the same size, so where each one goes is known up
+    // front and they can be built in any order
+    QVector<PatchInstance> instances = patchInstances();
+    QVector<int> order(instances.size());
+    for( int i = 0; i < order.size(); i++ )
+        order[i] = i;
+
+    auto build = [&](int i) {
+        buildPatch(i, instances[i], B.constData(), dB.constData(), Bv.constData(), dBv.constData(),
+                   in_v, in_n, in_tc, in_el, grid);
+    };
+
+    // Small teapots are done before the pool would have started
+    if( parallel && grid >= 16 )
+        QtConcurrent::blockingMap(order, build);
+    else
+        for( int i = 0; i < order.size(); i++ )
+            build(i);
+}
+
+QVector<float> Teapot::controlPoints(const QMatrix4x4& lidTransform)
+{
+    QVector<PatchInstance> instances = patchInstances();
+    QVector<float> points;
+    points.reserve(instances.size() * 16 * 3);
+
+    for( int i = 0; i < instances.size(); i++ )
+    {
+        const PatchInstance &instance = instances[i];
+        QVector3D patch[4][4];
+        getPatch(instance.patchNum, patch, instance.reverseV);
+
+        // Bezier patches follow their control points through affine
+        // transforms, so the lid moves the same way as the generated one
+        bool lid = i >= 12 && i < 20;
+        for( int uc = 0; uc < 4; uc++ )
+            for( int vc = 0; vc < 4; vc++ ) {
+                QVector3D p(instance.sx * patch[uc][vc].x(), instance.sy * patch[uc][vc].y(), patch[uc][vc].z());
+                if( lid )
+                    p = lidTransform * p;
+                points << p.x() << p.y() << p.z();
+            }
+    }
+    return points;
 }
 
 void Teapot::moveLid(int grid, float *in_v, const QMatrix4x4 & lidTransform) {
@@ -74,89 +138,40 @@ void Teapot::moveLid(int grid, float *in_v, const QMatrix4x4 & lidTransform) {
     }
 }
 
-void Teapot::buildPatchReflect(int patchNum,
-                                    float *B, float *dB,
-                                    float *in_v, float *in_n,
-                                    float *in_tc, unsigned int *in_el,
-                                    int &index, int &elIndex, int &tcIndex, int grid,
-                                    bool reflectX, bool reflectY)
+void Teapot::buildPatch(int instance, const PatchInstance &patchInstance,
+                        const float *B, const float *dB, const float *Bv, const float *dBv,
+                        float *in_v, float *in_n, float *in_tc, unsigned int *in_el, int grid)
 {
     QVector3D patch[4][4];
-    QVector3D patchRevV[4][4];
-    getPatch(patchNum, patch, false);
-    getPatch(patchNum, patchRevV, true);
-
-    // Patch without modification
-    buildPatch(patch, B, dB, in_v, in_n, in_tc, in_el,
-               index, elIndex, tcIndex, grid, QMatrix3x3(), true);
-
-    // Patch reflected in x
-    float matxdata[9] = {
-        -1.0f, 0.0f, 0.0f,
-         0.0f, 1.0f, 0.0f,
-         0.0f, 0.0f, 1.0f};
-
-    if( reflectX ) {
-        buildPatch(patchRevV, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matxdata), false );
-    }
-
-    // Patch reflected in y
-    float matydata[9] = {
-        1.0f,  0.0f, 0.0f,
-        0.0f, -1.0f, 0.0f,
-        0.0f,  0.0f, 1.0f
-    };
+    getPatch(patchInstance.patchNum, patch, patchInstance.reverseV);
 
-    if( reflectY ) {
-        buildPatch(patchRevV, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matydata), false );
-    }
-
-    // Patch reflected in x and y
-    float matxydata[9] = {
-       -1.0f,  0.0f, 0.0f,
-        0.0f, -1.0f, 0.0f,
-        0.0f,  0.0f, 1.0f
-    };
-    if( reflectX && reflectY ) {
-        buildPatch(patch, B, dB, in_v, in_n, in_tc, in_el,
-                   index, elIndex, tcIndex, grid, QMatrix3x3(matxydata), true );
-    }
-}
-
-void Teapot::buildPatch(QVector3D patch[][4],
-                           float *B, float *dB,
-                           float *in_v, float *in_n, float *in_tc,
-                           unsigned int *in_el,
-                           int &index, int &elIndex, int &tcIndex, int grid, QMatrix3x3 reflect,
-                           bool invertNormal)
-{
-    int startIndex = index / 3;
+    int startIndex = instance * (grid+1) * (grid+1);
+    int elIndex = instance * grid * grid * 6;
     float tcFactor = 1.0f / grid;
+    float normalSign = patchInstance.invertNormal ? -1.0f : 1.0f;
 
     for( int i = 0; i <= grid; i++ )
     {
-        for( int j = 0 ; j <= grid; j++)
-        {
-            QVector3D pt   = mattimesvec(reflect, evaluate(i,j,B,patch));
-            QVector3D norm = mattimesvec(reflect, evaluateNormal(i,j,B,dB,patch));
-            if( invertNormal )
-                norm = -norm;
-
-            in_v[index] = pt.x();
-            in_v[index+1] = pt.y();
-            in_v[index+2] = pt.z();
-
-            in_n[index] = norm.x();
-            in_n[index+1] = norm.y();
-            in_n[index+2] = norm.z();
+        // Blend the control points along u once per row, what is left per
+        // vertex is a cubic in v
+        float Pu[4][3], dPu[4][3];
+        for( int j = 0; j < 4; j++ )
+            for( int c = 0; c < 3; c++ ) {
+                Pu[j][c] = dPu[j][c] = 0.0f;
+                for( int k = 0; k < 4; k++ ) {
+                    Pu[j][c]  += patch[k][j][c] * B[i*4 + k];
+                    dPu[j][c] += patch[k][j][c] * dB[i*4 + k];
+                }
+            }
 
-            in_tc[tcIndex] = i * tcFactor;
-            in_tc[tcIndex+1] = j * tcFactor;
+        int rowStart = startIndex + i * (grid+1);
+        evaluateRow(Pu, dPu, Bv, dBv, grid + 1, patchInstance.sx, patchInstance.sy, normalSign,
+                    in_v + 3 * rowStart, in_n + 3 * rowStart);
 
-            index += 3;
-            tcIndex += 2;
+        for( int j = 0 ; j <= grid; j++)
+        {
+            in_tc[2 * (rowStart + j)] = i * tcFactor;
+            in_tc[2 * (rowStart + j) + 1] = j * tcFactor;
         }
     }
 
@@ -179,26 +194,6 @@ void Teapot::buildPatch(QVector3D patch[][4],
     }
 }
 
-QVector3D Teapot::mattimesvec(QMatrix3x3 inmat, QVector3D invec)
-{
-
-    QGenericMatrix<3,3,float> m1;
-    for (int r = 0; r < 3; ++r)
-        for (int c = 0; c < 3; ++c)
-            m1(r, c) = inmat(r, c);
-
-    float data[3];
-    data[0] = invec.x();
-    data[1] = invec.y();
-    data[2] = invec.z();
-
-    QGenericMatrix<1,3,float> m2(data);
-
-    QGenericMatrix<1,3,float> result = m1 * m2;
-
-    return QVector3D(result(0,0), result(1,0), result(2,0));
-}
-
 void Teapot::getPatch( int patchNum, QVector3D patch[][4], bool reverseV )
 {
     for( int uc = 0; uc < 4; uc++) {          // Loop in u direction
@@ -242,32 +237,85 @@ void Teapot::computeBasisFunctions( float * B, float * dB, int grid ) {
 }
 
 
-QVector3D Teapot::evaluate( int gridU, int gridV, float *B, QVector3D patch[][4] )
+// Positions and unit normals along one row of a patch, given the control
+// points already blended along u. Bv and dBv hold the v basis functions
+// and their derivatives, count samples each. Four vertices per step with
+// SSE2, the normal is zero where the patch degenerates to a point.
+void Teapot::evaluateRow( const float Pu[4][3], const float dPu[4][3], const float *Bv, const float *dBv,
+                          int count, float sx, float sy, float normalSign, float *outV, float *outN )
 {
-    QVector3D p(0.0f,0.0f,0.0f);
-    for( int i = 0; i < 4; i++) {
-        for( int j = 0; j < 4; j++) {
-            p += patch[i][j] * B[gridU*4+i] * B[gridV*4+j];
+    const float scale[3] = { sx, sy, 1.0f };
+    int j = 0;
+
+#if defined(TEAPOT_SSE)
+    for( ; j + 4 <= count; j += 4 )
+    {
+        __m128 b[4], db[4];
+        for( int k = 0; k < 4; k++ ) {
+            b[k] = _mm_loadu_ps(Bv + k*count + j);
+            db[k] = _mm_loadu_ps(dBv + k*count + j);
         }
-    }
-    return p;
-}
 
-QVector3D Teapot::evaluateNormal( int gridU, int gridV, float *B, float *dB, QVector3D patch[][4] )
-{
-    QVector3D du(0.0f,0.0f,0.0f);
-    QVector3D dv(0.0f,0.0f,0.0f);
+        __m128 p[3], du[3], dv[3];
+        for( int c = 0; c < 3; c++ ) {
+            p[c] = du[c] = dv[c] = _mm_setzero_ps();
+            for( int k = 0; k < 4; k++ ) {
+                __m128 pu = _mm_set1_ps(Pu[k][c]);
+                __m128 dpu = _mm_set1_ps(dPu[k][c]);
+                p[c]  = _mm_add_ps(p[c],  _mm_mul_ps(pu, b[k]));
+                du[c] = _mm_add_ps(du[c], _mm_mul_ps(dpu, b[k]));
+                dv[c] = _mm_add_ps(dv[c], _mm_mul_ps(pu, db[k]));
+            }
+        }
 
-    for( int i = 0; i < 4; i++) {
-        for( int j = 0; j < 4; j++) {
-            du += patch[i][j] * dB[gridU*4+i] * B[gridV*4+j];
-            dv += patch[i][j] * B[gridU*4+i] * dB[gridV*4+j];
+        __m128 nrm[3];
+        nrm[0] = _mm_sub_ps(_mm_mul_ps(du[1], dv[2]), _mm_mul_ps(du[2], dv[1]));
+        nrm[1] = _mm_sub_ps(_mm_mul_ps(du[2], dv[0]), _mm_mul_ps(du[0], dv[2]));
+        nrm[2] = _mm_sub_ps(_mm_mul_ps(du[0], dv[1]), _mm_mul_ps(du[1], dv[0]));
+
+        __m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nrm[0], nrm[0]), _mm_mul_ps(nrm[1], nrm[1])),
+                                  _mm_mul_ps(nrm[2], nrm[2]));
+        __m128 valid = _mm_cmpgt_ps(lenSq, _mm_set1_ps(1.0e-12f));
+        __m128 invLen = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(normalSign), _mm_sqrt_ps(_mm_max_ps(lenSq, _mm_set1_ps(1.0e-12f)))));
+
+        float pos[3][4], norm[3][4];
+        for( int c = 0; c < 3; c++ ) {
+            __m128 s = _mm_set1_ps(scale[c]);
+            _mm_storeu_ps(pos[c], _mm_mul_ps(p[c], s));
+            _mm_storeu_ps(norm[c], _mm_mul_ps(_mm_mul_ps(nrm[c], invLen), s));
         }
+
+        for( int k = 0; k < 4; k++ )
+            for( int c = 0; c < 3; c++ ) {
+                outV[3 * (j + k) + c] = pos[c][k];
+                outN[3 * (j + k) + c] = norm[c][k];
+            }
     }
+#endif
 
-    QVector3D norm = QVector3D::normal(du, dv);
+    for( ; j < count; j++ )
+    {
+        float p[3], du[3], dv[3];
+        for( int c = 0; c < 3; c++ ) {
+            p[c] = du[c] = dv[c] = 0.0f;
+            for( int k = 0; k < 4; k++ ) {
+                p[c]  += Pu[k][c] * Bv[k*count + j];
+                du[c] += dPu[k][c] * Bv[k*count + j];
+                dv[c] += Pu[k][c] * dBv[k*count + j];
+            }
+        }
 
-    return norm;
+        float nrm[3] = { du[1] * dv[2] - du[2] * dv[1],
+                         du[2] * dv[0] - du[0] * dv[2],
+                         du[0] * dv[1] - du[1] * dv[0] };
+        float lenSq = nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2];
+        float invLen = lenSq > 1.0e-12f ? normalSign / sqrtf(lenSq) : 0.0f;
+
+        for( int c = 0; c < 3; c++ ) {
+            outV[3 * j + c] = p[c] * scale[c];
+            outN[3 * j + c] = nrm[c] * invLen * scale[c];
+        }
+    }
 }
 
 float *Teapot::getv()
@@ -2,8 +2,8 @@
 #define VBOTEAPOT_H
 
 #include <QMatrix4x4>
-#include <QMatrix3x3>
 #include <QVector3D>
+#include <QVector>
 
 class Teapot
 {
@@ -25,27 +25,34 @@ private:
 
     void generateVerts(float * , float * ,float *, unsigned int *, float , float);
 
-    void generatePatches(float * in_v, float * in_n, float *in_tc, unsigned int* in_el, int grid);
-    void buildPatchReflect(int patchNum,
-                           float *B, float *dB,
-                           float *v, float *n, float *, unsigned int *el,
-                           int &index, int &elIndex, int &, int grid,
-                           bool reflectX, bool reflectY);
-    void buildPatch(QVector3D patch[][4],
-                    float *B, float *dB,
-                    float *in_v, float *in_n, float *in_tc, unsigned int *in_el,
-                    int &index, int &elIndex, int &, int grid, QMatrix3x3 reflect, bool invertNormal);
-    void getPatch( int patchNum, QVector3D patch[][4], bool reverseV );
+    // One of the 32 output patches: a patch of the data, possibly mirrored.
+    // The reflections are sign flips of x and y.
+    struct PatchInstance
+    {
+        int   patchNum;
+        bool  reverseV;
+        float sx, sy;
+        bool  invertNormal;
+    };
+
+    static QVector<PatchInstance> patchInstances();
+
+    void generatePatches(float * in_v, float * in_n, float *in_tc, unsigned int* in_el, int grid, bool parallel);
+    void buildPatch(int instance, const PatchInstance &patch,
+                    const float *B, const float *dB, const float *Bv, const float *dBv,
+                    float *in_v, float *in_n, float *in_tc, unsigned int *in_el, int grid);
+    static void getPatch( int patchNum, QVector3D patch[][4], bool reverseV );
 
     void computeBasisFunctions( float * B, float * dB, int grid );
-    QVector3D evaluate( int gridU, int gridV, float *B, QVector3D patch[][4] );
-    QVector3D evaluateNormal( int gridU, int gridV, float *B, float *dB, QVector3D patch[][4] );
+    static void evaluateRow( const float Pu[4][3], const float dPu[4][3], const float *Bv, const float *dBv,
+                             int count, float sx, float sy, float normalSign, float *outV, float *outN );
     void moveLid(int,float *,const QMatrix4x4 &);
-    QVector3D mattimesvec(QMatrix3x3, QVector3D);
 
 public:
     ~Teapot();
-    Teapot(int grid, const QMatrix4x4& lidTransform);
+    // The patches are generated on the global thread pool unless parallel
+    // is false
+    Teapot(int grid, const QMatrix4x4& lidTransform, bool parallel = true);
 
     float *getv();
     int    getnVerts();
@@ -54,6 +61,10 @@ public:
     unsigned int *getelems();
 
     int    getnFaces();
+
+    // The same 32 patches as 16 control points each, mirrored copies
+    // included, for tessellation on the GPU. 3 floats per point.
+    static QVector<float> controlPoints(const QMatrix4x4& lidTransform);
 };
 
 #endif // VBOTEAPOT_H
@@ -0,0 +1,255 @@
+#include "tessbench.h"
+
+#include "teapot.h"
+#include "teapotdata.h"
+
+#include <QElapsedTimer>
+#include <QGenericMatrix>
+#include <QThread>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+
+#include <cmath>
+#include <cstdio>
+
+// The evaluation Teapot used before the row kernel: a QVector3D sum over
+// the 16 control points per vertex and a QGenericMatrix product for every
+// reflected vertex and normal. Kept here as the baseline the kernel and
+// the sign-flip reflections are measured against.
+namespace Reference {
+
+struct Mesh {
+    QVector<float> v, n, tc;
+    QVector<unsigned int> el;
+};
+
+static void computeBasisFunctions( float * B, float * dB, int grid ) {
+    float inc = 1.0f / grid;
+    for( int i = 0; i <= grid; i++ )
+    {
+        float t = i * inc;
+        float tSqr = t * t;
+        float oneMinusT = (1.0f - t);
+        float oneMinusT2 = oneMinusT * oneMinusT;
+
+        B[i*4 + 0] = oneMinusT * oneMinusT2;
+        B[i*4 + 1] = 3.0f * oneMinusT2 * t;
+        B[i*4 + 2] = 3.0f * oneMinusT * tSqr;
+        B[i*4 + 3] = t * tSqr;
+
+        dB[i*4 + 0] = -3.0f * oneMinusT2;
+        dB[i*4 + 1] = -6.0f * t * oneMinusT + 3.0f * oneMinusT2;
+        dB[i*4 + 2] = -3.0f * tSqr + 6.0f * t * oneMinusT;
+        dB[i*4 + 3] = 3.0f * tSqr;
+    }
+}
+
+static void getPatch( int patchNum, QVector3D patch[][4], bool reverseV )
+{
+    for( int uc = 0; uc < 4; uc++) {
+        for( int vc = 0; vc < 4; vc++ ) {
+            int point = TeapotData::patchdata[patchNum][uc*4 + (reverseV ? 3-vc : vc)];
+            patch[uc][vc] = QVector3D(TeapotData::cpdata[point][0], TeapotData::cpdata[point][1],
+                                      TeapotData::cpdata[point][2]);
+        }
+    }
+}
+
+static QVector3D mattimesvec( const QMatrix3x3 &inmat, const QVector3D &invec )
+{
+    QGenericMatrix<3,3,float> m1;
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            m1(r, c) = inmat(r, c);
+
+    float data[3] = { invec.x(), invec.y(), invec.z() };
+    QGenericMatrix<1,3,float> m2(data);
+    QGenericMatrix<1,3,float> result = m1 * m2;
+
+    return QVector3D(result(0,0), result(1,0), result(2,0));
+}
+
+static QVector3D evaluate( int gridU, int gridV, const float *B, QVector3D patch[][4] )
+{
+    QVector3D p(0.0f,0.0f,0.0f);
+    for( int i = 0; i < 4; i++)
+        for( int j = 0; j < 4; j++)
+            p += patch[i][j] * B[gridU*4+i] * B[gridV*4+j];
+    return p;
+}
+
+static QVector3D evaluateNormal( int gridU, int gridV, const float *B, const float *dB, QVector3D patch[][4] )
+{
+    QVector3D du(0.0f,0.0f,0.0f);
+    QVector3D dv(0.0f,0.0f,0.0f);
+    for( int i = 0; i < 4; i++) {
+        for( int j = 0; j < 4; j++) {
+            du += patch[i][j] * dB[gridU*4+i] * B[gridV*4+j];
+            dv += patch[i][j] * B[gridU*4+i] * dB[gridV*4+j];
+        }
+    }
+    return QVector3D::normal(du, dv);
+}
+
+static void buildPatch( QVector3D patch[][4], const float *B, const float *dB, Mesh &mesh,
+                        int &index, int &elIndex, int &tcIndex, int grid, const QMatrix3x3 &reflect,
+                        bool invertNormal )
+{
+    int startIndex = index / 3;
+    float tcFactor = 1.0f / grid;
+
+    for( int i = 0; i <= grid; i++ )
+    {
+        for( int j = 0 ; j <= grid; j++)
+        {
+            QVector3D pt   = mattimesvec(reflect, evaluate(i,j,B,patch));
+            QVector3D norm = mattimesvec(reflect, evaluateNormal(i,j,B,dB,patch));
+            if( invertNormal )
+                norm = -norm;
+
+            mesh.v[index] = pt.x();
+            mesh.v[index+1] = pt.y();
+            mesh.v[index+2] = pt.z();
+            mesh.n[index] = norm.x();
+            mesh.n[index+1] = norm.y();
+            mesh.n[index+2] = norm.z();
+            mesh.tc[tcIndex] = i * tcFactor;
+            mesh.tc[tcIndex+1] = j * tcFactor;
+
+            index += 3;
+            tcIndex += 2;
+        }
+    }
+
+    for( int i = 0; i < grid; i++ )
+    {
+        int iStart = i * (grid+1) + startIndex;
+        int nextiStart = (i+1) * (grid+1) + startIndex;
+        for( int j = 0; j < grid; j++)
+        {
+            mesh.el[elIndex] = iStart + j;
+            mesh.el[elIndex+1] = nextiStart + j + 1;
+            mesh.el[elIndex+2] = nextiStart + j;
+            mesh.el[elIndex+3] = iStart + j;
+            mesh.el[elIndex+4] = iStart + j + 1;
+            mesh.el[elIndex+5] = nextiStart + j + 1;
+            elIndex += 6;
+        }
+    }
+}
+
+static void buildPatchReflect( int patchNum, const float *B, const float *dB, Mesh &mesh,
+                               int &index, int &elIndex, int &tcIndex, int grid, bool reflectX, bool reflectY )
+{
+    QVector3D patch[4][4];
+    QVector3D patchRevV[4][4];
+    getPatch(patchNum, patch, false);
+    getPatch(patchNum, patchRevV, true);
+
+    const float matxdata[9]  = { -1.0f, 0.0f, 0.0f,  0.0f,  1.0f, 0.0f,  0.0f, 0.0f, 1.0f };
+    const float matydata[9]  = {  1.0f, 0.0f, 0.0f,  0.0f, -1.0f, 0.0f,  0.0f, 0.0f, 1.0f };
+    const float matxydata[9] = { -1.0f, 0.0f, 0.0f,  0.0f, -1.0f, 0.0f,  0.0f, 0.0f, 1.0f };
+
+    buildPatch(patch, B, dB, mesh, index, elIndex, tcIndex, grid, QMatrix3x3(), true);
+    if( reflectX )
+        buildPatch(patchRevV, B, dB, mesh, index, elIndex, tcIndex, grid, QMatrix3x3(matxdata), false);
+    if( reflectY )
+        buildPatch(patchRevV, B, dB, mesh, index, elIndex, tcIndex, grid, QMatrix3x3(matydata), false);
+    if( reflectX && reflectY )
+        buildPatch(patch, B, dB, mesh, index, elIndex, tcIndex, grid, QMatrix3x3(matxydata), true);
+}
+
+static void build( int grid, const QMatrix4x4 &lidTransform, Mesh &mesh )
+{
+    int nVerts = 32 * (grid + 1) * (grid + 1);
+    mesh.v.resize(nVerts * 3);
+    mesh.n.resize(nVerts * 3);
+    mesh.tc.resize(nVerts * 2);
+    mesh.el.resize(grid * grid * 32 * 6);
+
+    QVector<float> B(4*(grid+1)), dB(4*(grid+1));
+    computeBasisFunctions(B.data(), dB.data(), grid);
+
+    // Rim, body, lid and bottom in all four quadrants, handle and spout in y
+    int idx = 0, elIndex = 0, tcIndex = 0;
+    for( int patchNum = 0; patchNum < 10; patchNum++ )
+        buildPatchReflect(patchNum, B.constData(), dB.constData(), mesh, idx, elIndex, tcIndex, grid,
+                          patchNum < 6, true);
+
+    // moveLid
+    int start = 3 * 12 * (grid+1) * (grid+1);
+    int end = 3 * 20 * (grid+1) * (grid+1);
+    for( int i = start; i < end; i+=3 )
+    {
+        QVector4D vert = lidTransform * QVector4D(mesh.v[i], mesh.v[i+1], mesh.v[i+2], 1.0f);
+        mesh.v[i] = vert.x();
+        mesh.v[i+1] = vert.y();
+        mesh.v[i+2] = vert.z();
+    }
+}
+
+} // namespace Reference
+
+enum BuildPath { REFERENCE, SERIAL, PARALLEL };
+
+// Best of a few constructions, in milliseconds
+static double buildMs(int grid, BuildPath path)
+{
+    double best = 0.0;
+    for (int round = 0; round < 3; round++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        if (path == REFERENCE) {
+            Reference::Mesh mesh;
+            Reference::build(grid, QMatrix4x4(), mesh);
+        } else {
+            Teapot teapot(grid, QMatrix4x4(), path == PARALLEL);
+        }
+        double ms = timer.nsecsElapsed() / 1.0e6;
+        if (round == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+// Largest difference of the positions from the reference, the kernel
+// only reorders the float arithmetic
+static float maxPositionError(int grid)
+{
+    Reference::Mesh mesh;
+    Reference::build(grid, QMatrix4x4(), mesh);
+    Teapot teapot(grid, QMatrix4x4(), false);
+
+    float error = 0.0f;
+    const float *v = teapot.getv();
+    for (int i = 0; i < mesh.v.size(); i++)
+        error = qMax(error, (float)fabs(v[i] - mesh.v[i]));
+    return error;
+}
+
+int runTessellationBenchmark(const QList<int> &grids)
+{
+    printf("Teapot tessellation, %d threads, reference is the old QVector3D evaluation\n", QThread::idealThreadCount());
+    printf("%6s %10s %12s %12s %12s %14s %9s %9s %10s\n", "grid", "verts", "ref ms", "serial ms", "parallel ms",
+           "Mverts/s", "serial", "parallel", "max diff");
+
+    for (int i = 0; i < grids.size(); i++)
+    {
+        int grid = grids[i];
+        if (grid < 1)
+            continue;
+
+        int nVerts = 32 * (grid + 1) * (grid + 1);
+        double reference = buildMs(grid, REFERENCE);
+        double serial = buildMs(grid, SERIAL);
+        double parallel = buildMs(grid, PARALLEL);
+
+        // Speedups are against the reference
+        printf("%6d %10d %12.3f %12.3f %12.3f %14.1f %8.2fx %8.2fx %10.2g\n", grid, nVerts, reference, serial, parallel,
+               nVerts / (parallel * 1000.0), reference / serial, reference / parallel, maxPositionError(grid));
+    }
+
+    return 0;
+}
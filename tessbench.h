@@ -0,0 +1,11 @@
+#ifndef TESSBENCH_H
+#define TESSBENCH_H
+
+#include <QList>
+
+// Time to generate the teapot at each grid with the old per-vertex
+// QVector3D evaluation, and with the row kernel on one thread and on the
+// thread pool. Runs on the CPU only.
+int runTessellationBenchmark(const QList<int> &grids);
+
+#endif // TESSBENCH_H
@@ -0,0 +1,46 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <QOpenGLFunctions>
+
+// CPU mirrors of the blocks declared in uniformblocks.txt. Keep the member
+// order and padding in sync with the shaders.
+
+#define MAX_CASCADES 4
+
+namespace UniformBinding {
+    enum Binding {
+        FRAME = 0,      // Uniform buffer
+        OBJECTS = 1     // Shader storage buffer
+    };
+}
+
+// layout(std140, binding = 0) uniform FrameBlock
+struct FrameUniforms
+{
+    GLfloat ViewMatrix[16];
+    GLfloat ProjectionMatrix[16];
+    GLfloat ViewProjectionMatrix[16];
+    GLfloat ShadowMatrix[16];       // Bias * light projection * light view
+    GLfloat LightPosition[4];       // Eye coords
+    GLfloat LightIntensity[4];      // xyz used
+    GLfloat CascadeViewProj[MAX_CASCADES][16];
+    GLfloat CascadeShadowMatrix[MAX_CASCADES][16];
+    GLfloat CascadeSplits[MAX_CASCADES];
+    GLfloat TessParams[4];          // Viewport width and height, pixels per edge, max level
+    GLfloat ShadowParams[4];        // Light far plane, ESM exponent, VSM min variance and bleed reduction
+};
+
+// One element of the std430 ObjectBlock storage buffer, its size is a
+// multiple of 16 bytes so it also matches the array stride
+struct ObjectUniforms
+{
+    GLfloat ModelMatrix[16];        // Includes the mesh position transform
+    GLfloat NormalMatrix[12];       // World space mat3, each column padded to a vec4
+    GLfloat Ka[4];                  // vec3 + pad
+    GLfloat Kd[4];                  // vec3 + pad
+    GLfloat Ks[3];
+    GLfloat Shininess;              // Packed in the last slot of Ks
+};
+
+#endif // UNIFORMBLOCKS_H